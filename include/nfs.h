@@ -9,8 +9,12 @@
 #include "string.h"
 #include "fuse.h"
 #include <stddef.h>
+#include <limits.h>
 #include "ddriver.h"
 #include "errno.h"
+#include <pthread.h>
+#include <time.h>
+#include <sys/uio.h>
 #include "types.h"
 #include "stdint.h"
 
@@ -21,6 +25,30 @@
 *******************************************************************************/
 #define NFS_DBG(fmt, ...) do { printf("NFS_DBG: " fmt, ##__VA_ARGS__); } while(0)
 /******************************************************************************
+* SECTION: 加锁顺序
+* 0. 日志的txn_lock: 修改文件系统的操作(mkdir/mknod/write/truncate)在解析路径之前持读锁，
+*    提交日志时持写锁写回所有脏inode(再获取各inode写锁)；journal.lock只在排队提交时短暂持有，
+*    单个文件的提交(fsync/flush/release)不获取txn_lock，排到提交权后只持该文件的写锁；
+*    inode缓存回收时持写锁，再获取load_lock，对inode写锁只trylock
+* 1. inode读写锁(nfs_inode.lock): 父目录先于子目录/文件加锁，同一层级不同时持有两把
+*    - mkdir/mknod: 持父目录写锁，重新检查同名后再分配inode并插入目录项
+*    - read持文件读锁，write/truncate持文件写锁
+* 2. 以下均为叶子锁，持有期间不再获取inode锁:
+*    load_lock(读入inode、inode缓存的淘汰链表) -> bm_lock(位图) -> dirty_lock(脏链表) -> bcache.lock(块缓存，可重入)
+*    对象池的slab.lock只在分配/释放单个对象时持有，可在以上任意锁内获取
+*    flush_lock(后台写回)只在未持有其他锁或只持有inode写锁(唤醒写回线程)时获取，
+*    写回线程和等待写回的前台操作持有flush_lock时不获取其他锁
+*    dcache.lock(路径缓存的修改)独立使用，不与其他锁嵌套
+*    ra.lock(预读队列)只在放入/取出预读请求时持有，预读线程读盘时不持有
+*    日志区的读写、检查点在持有bcache.lock时进行
+* 3. 无锁读路径: lookup、getattr、readdir以及路径缓存的查询不加任何锁，
+*    在nfs_epoch_enter/nfs_epoch_exit之间用NFS_LOAD读取写者用NFS_STORE发布的字段，
+*    被替换或删除的哈希索引、路径缓存条目以及被淘汰的inode和目录项通过nfs_epoch_retire延迟释放；
+*    read/open/fsync等只读操作没有句柄时也在临界区内访问解析得到的目录项和inode
+* 4. 低层接口(nfs_ll.c)按inode号访问: 内核的lookup计数与句柄一样计入inode->ref，
+*    被内核引用的inode及其所有上级目录不会被淘汰，请求中的inode号不经路径解析直接映射到inode
+*******************************************************************************/
+/******************************************************************************
 * SECTION: nfs.c
 *******************************************************************************/
 char* 			   nfs_get_fname(const char* path);
@@ -32,17 +60,48 @@ int 			   nfs_driver_write(int offset, uint8_t *in_content, int size);
 int 			   nfs_mount(struct custom_options options);
 int 			   nfs_umount();
 
+struct nfs_dentry* new_dentry(struct nfs_inode* dir, const char* fname, NFS_FILE_TYPE ftype);
 int 			   nfs_alloc_dentry(struct nfs_inode * inode, struct nfs_dentry * dentry);
 struct nfs_inode*  nfs_alloc_inode(struct nfs_dentry * dentry);
+void 			   nfs_free_inode(int ino);
+void               nfs_discard_inode(struct nfs_inode* inode);
+int                nfs_create(struct nfs_inode* parent, const char* fname, NFS_FILE_TYPE ftype,
+                              struct nfs_dentry** dentry);
 int 			   nfs_alloc_data();
+int 			   nfs_alloc_data_range(int n);
+void 			   nfs_free_data(int data_no, int n);
+int                nfs_bmap(struct nfs_inode* inode, int blk_no);
+int                nfs_inode_extend(struct nfs_inode* inode, int n);
+void               nfs_inode_dirty(struct nfs_inode* inode, int flags);
+void               nfs_inode_dirty_block(struct nfs_inode* inode, int blk_no);
+void               nfs_inode_touch(struct nfs_inode* inode, int flags, const struct timespec* ts);
+int                nfs_sync_inodes();
+int                nfs_sync_inode_bits(struct nfs_inode* inode);
+int                nfs_sync_dirty(time_t expire, int target);
+void               nfs_prefetch_inodes(struct nfs_inode* inode, boolean async);
+void               nfs_inode_shrink(struct nfs_inode* inode, int blk_cnt);
 int 			   nfs_sync_inode(struct nfs_inode * inode);
 struct nfs_inode*  nfs_read_inode(struct nfs_dentry * dentry, int ino);
 struct nfs_dentry* nfs_get_dentry(struct nfs_inode * inode, int dir);
 
 struct nfs_dentry* nfs_lookup(const char * path, boolean * is_find, boolean* is_root);
+uint8_t*           nfs_inode_block(struct nfs_inode* inode, int blk_no, boolean create);
+int                nfs_inode_expand(struct nfs_inode* inode, int size);
+int                nfs_inode_truncate(struct nfs_inode* inode, int size);
+int                nfs_inode_write(struct nfs_inode* inode, const char* buf, size_t size, off_t offset);
+int                nfs_inode_read(struct nfs_inode* inode, struct nfs_fhandle* fh, char* buf, size_t size, off_t offset);
+int                nfs_inode_read_iov(struct nfs_inode* inode, struct nfs_fhandle* fh, struct iovec* iov, size_t size, off_t offset);
+void               nfs_inode_utimens(struct nfs_inode* inode, const struct timespec tv[2]);
+struct nfs_inode*  nfs_dentry_inode(struct nfs_dentry* dentry);
+struct nfs_inode*  nfs_inode_get(struct nfs_dentry* dentry);
+void               nfs_inode_put(struct nfs_inode* inode, int n);
+struct nfs_fhandle* nfs_fhandle_get(struct nfs_dentry* dentry);
+void               nfs_fhandle_put(struct nfs_fhandle* fh);
 /******************************************************************************
 * SECTION: nfs.c
 *******************************************************************************/
+int                nfs_fill_stat(struct nfs_dentry* dentry, struct stat* nfs_stat);
+void               nfs_conn_setup(struct fuse_conn_info* conn);
 void* 			   nfs_init(struct fuse_conn_info *);
 void  			   nfs_destroy(void *);
 int   			   nfs_mkdir(const char *, mode_t);
@@ -62,7 +121,126 @@ int   			   nfs_utimens(const char *, const struct timespec tv[2]);
 int   			   nfs_truncate(const char *, off_t);
 			
 int   			   nfs_open(const char *, struct fuse_file_info *);
+int   			   nfs_flush(const char *, struct fuse_file_info *);
+int   			   nfs_release(const char *, struct fuse_file_info *);
 int   			   nfs_opendir(const char *, struct fuse_file_info *);
+int   			   nfs_releasedir(const char *, struct fuse_file_info *);
+int   			   nfs_fsync(const char *, int, struct fuse_file_info *);
+int   			   nfs_fsyncdir(const char *, int, struct fuse_file_info *);
+
+/******************************************************************************
+* SECTION: nfs_ll.c
+*******************************************************************************/
+int                nfs_ll_main(struct fuse_args* args);
+
+/******************************************************************************
+* SECTION: nfs_cache.c
+*******************************************************************************/
+int                nfs_bcache_init(int nbufs);
+struct nfs_buf*    nfs_bread(int blk);
+struct nfs_buf*    nfs_bget(int blk);
+void               nfs_bdirty(struct nfs_buf* buf);
+int                nfs_bmeta(int blk);
+void               nfs_bcache_meta_max(int n);
+int                nfs_bcache_meta(struct nfs_buf** bufs, int max);
+void               nfs_bcache_logged(struct nfs_buf** bufs, int n);
+int                nfs_bcache_sync();
+int                nfs_bcache_sync_data();
+int                nfs_bcache_prefetch(int blk, int n);
+void               nfs_bcache_lock();
+void               nfs_bcache_unlock();
+int                nfs_bcache_destroy();
+
+/******************************************************************************
+* SECTION: nfs_bitmap.c
+*******************************************************************************/
+void               nfs_bitmap_init(struct nfs_bitmap* bm, uint8_t* map, int nbits);
+int                nfs_bitmap_alloc(struct nfs_bitmap* bm);
+int                nfs_bitmap_alloc_range(struct nfs_bitmap* bm, int n);
+void               nfs_bitmap_set(struct nfs_bitmap* bm, int start, int n);
+void               nfs_bitmap_free(struct nfs_bitmap* bm, int start, int n);
+boolean            nfs_bitmap_test(struct nfs_bitmap* bm, int bit);
+
+/******************************************************************************
+* SECTION: nfs_dir.c
+*******************************************************************************/
+uint32_t           nfs_name_hash(const char* name);
+int                nfs_dir_index_build(struct nfs_inode* inode);
+void               nfs_dir_index_add(struct nfs_inode* inode, struct nfs_dentry* dentry);
+struct nfs_dentry* nfs_dir_lookup(struct nfs_inode* inode, const char* name);
+char*              nfs_dir_name_store(struct nfs_inode* inode, const char* name, int len);
+long               nfs_dir_names_free(struct nfs_inode* inode);
+
+/******************************************************************************
+* SECTION: nfs_dcache.c
+*******************************************************************************/
+void               nfs_dcache_init(int max);
+boolean            nfs_dcache_lookup(const char* path, struct nfs_dentry** dentry);
+uint32_t           nfs_dcache_gen();
+void               nfs_dcache_add(const char* path, struct nfs_dentry* dentry, uint32_t gen);
+void               nfs_dcache_invalidate(const char* path);
+void               nfs_dcache_invalidate_prefix(const char* path);
+void               nfs_dcache_destroy();
+
+/******************************************************************************
+* SECTION: nfs_flush.c
+*******************************************************************************/
+int                nfs_flush_start(int interval, int limit_kb);
+void               nfs_flush_stop();
+void               nfs_flush_kick();
+void               nfs_flush_throttle();
+void               nfs_flush_error();
+int                nfs_flush_check(struct nfs_fhandle* fh);
+
+/******************************************************************************
+* SECTION: nfs_readahead.c
+*******************************************************************************/
+int                nfs_readahead_start(int max_kb);
+void               nfs_readahead_stop();
+void               nfs_readahead_submit(int blk, int n);
+void               nfs_readahead(struct nfs_inode* inode, struct nfs_fhandle* fh, off_t offset, size_t size);
+
+/******************************************************************************
+* SECTION: nfs_journal.c
+*******************************************************************************/
+int                nfs_journal_init(int offset, int blks, boolean is_init);
+void               nfs_journal_begin();
+void               nfs_journal_end();
+void               nfs_journal_lock();
+void               nfs_journal_unlock();
+int                nfs_journal_commit(boolean checkpoint);
+int                nfs_journal_commit_inode(struct nfs_inode* inode);
+int                nfs_journal_split();
+void               nfs_journal_revoke(int blk, int n);
+boolean            nfs_journal_pending();
+void               nfs_journal_destroy();
+
+/******************************************************************************
+* SECTION: nfs_icache.c
+*******************************************************************************/
+void               nfs_icache_init(int limit_kb);
+void               nfs_icache_charge(long bytes);
+void               nfs_icache_add(struct nfs_inode* inode);
+void               nfs_icache_del(struct nfs_inode* inode);
+void               nfs_icache_free(void* ptr);
+void               nfs_icache_balance();
+void               nfs_icache_destroy();
+
+/******************************************************************************
+* SECTION: nfs_slab.c
+*******************************************************************************/
+void               nfs_slab_init(struct nfs_slab* slab, const char* name, int obj_sz);
+void*              nfs_slab_alloc(struct nfs_slab* slab);
+void               nfs_slab_free(struct nfs_slab* slab, void* obj);
+void               nfs_slab_destroy(struct nfs_slab* slab);
+
+/******************************************************************************
+* SECTION: nfs_epoch.c
+*******************************************************************************/
+void               nfs_epoch_enter();
+void               nfs_epoch_exit();
+void               nfs_epoch_retire(void* ptr, void (*free_fn)(void*));
+void               nfs_epoch_destroy();
 
 /******************************************************************************
 * SECTION: nfs_debug.c
@@ -7,6 +7,7 @@
 #define MAX_NAME_LEN    128
 #define TRUE            1
 #define FALSE           0  
+#define UINT64_BITS             64
 #define UINT32_BITS             32
 #define UINT8_BITS              8
 
@@ -18,32 +19,83 @@
 #define NFS_ERROR_ACCESS        EACCES
 #define NFS_ERROR_SEEK          ESPIPE     
 #define NFS_ERROR_ISDIR         EISDIR
+#define NFS_ERROR_NOTDIR        ENOTDIR
+#define NFS_ERROR_NOMEM         ENOMEM
+#define NFS_ERROR_FBIG          EFBIG
 #define NFS_ERROR_NOSPACE       ENOSPC
 #define NFS_ERROR_EXISTS        EEXIST
 #define NFS_ERROR_NOTFOUND      ENOENT
 #define NFS_ERROR_UNSUPPORTED   ENXIO
 #define NFS_ERROR_IO            EIO     /* Error Input/Output */
 #define NFS_ERROR_INVAL         EINVAL  /* Invalid Args */
+#define NFS_ERROR_AGAIN         EAGAIN  /* 无法单独完成，需退回到整体处理 */
+#define NFS_ERROR_NOSYS         ENOSYS  /* 不支持的操作 */
+#define NFS_ERROR_NAMETOOLONG   ENAMETOOLONG  /* 文件名超过MAX_NAME_LEN */
 
 #define NFS_INODE_PER_FILE      1
-#define NFS_DATA_PER_FILE       6
 #define NFS_DEFAULT_PERM        0777
 
+#define NFS_LAYOUT_VERSION      5   // 磁盘格式版本，与磁盘上不一致时拒绝挂载，只有空白或其他文件系统的磁盘才会被格式化
+#define NFS_INODE_PER_BLK       4   // 一个逻辑块存放的inode数量
+#define NFS_INODE_D_SZ          256   // 磁盘上一个inode槽的大小
+#define NFS_INLINE_MAX          96   // 不超过该大小且没有数据块的普通文件，内容直接存放在inode槽中
+#define NFS_EXTENT_INLINE       12   // inode中直接保存的extent数量，更多的extent保存在溢出extent块中
+
 #define NFS_IOC_MAGIC           'S'
 #define NFS_IOC_SEEK            _IO(NFS_IOC_MAGIC, 0)
 
 #define NFS_FLAG_BUF_DIRTY      0x1
 #define NFS_FLAG_BUF_OCCUPY     0x2
+#define NFS_FLAG_BUF_META       0x4   // 未写入日志的元数据，不能写回原位置
+#define NFS_FLAG_BUF_LOGGED     0x8   // 已写入日志、尚未写回原位置的元数据
+
+#define NFS_JOURNAL_MAGIC       0x4a4e4653   // 日志头幻数
+#define NFS_JOURNAL_TXN_MAGIC   0x54584e53   // 事务头幻数
+
+#define NFS_INODE_DIRTY_META    0x1   // inode本身(大小、extent表等)需要写回
+#define NFS_INODE_DIRTY_DATA    0x2   // 有数据块(文件内容或目录项)需要写回，见block_dirty
+#define NFS_INODE_DIRTY_NEW     0x4   // 新建后尚未写回过，引用它的目录项也还没有写回
+
+#define NFS_TIME_ATIME          0x1   // nfs_inode_touch更新的时间戳
+#define NFS_TIME_MTIME          0x2
+#define NFS_TIME_CTIME          0x4
+
+#define NFS_DIR_HASH_INIT       16   // 目录哈希索引的初始槽数，必须为2的幂
+#define NFS_DIR_BLK_MAGIC       0x4446   // 目录项块头幻数
+#define NFS_DIR_BLK_VERSION     1   // 目录项块格式版本
+
+#define NFS_FLUSH_INTERVAL      5   // 后台写回线程的默认唤醒周期(秒)，脏了这么久的inode会被写回
+#define NFS_DIRTY_LIMIT         1024   // 默认的脏数据上限(KB)，超过一半时唤醒后台写回，超过上限时前台写操作等待
+
+#define NFS_DCACHE_DEFAULT      4096   // 路径缓存默认容量(条目数)
+#define NFS_DCACHE_HASH_SZ      4096   // 路径缓存哈希桶数量
+
+#define NFS_CACHE_TIMEOUT       60   // 内核属性及目录项缓存的默认有效期(秒)，所有修改都经过本文件系统，缓存不会过时
+#define NFS_MAX_WRITE           128   // 与内核协商的单次写请求上限(KB)，libfuse 2.x最多为128KB
+#define NFS_MAX_READAHEAD       128   // 与内核协商的预读上限(KB)，不超过内核提出的值
+#define NFS_MEM_LIMIT           2048   // inode缓存默认的内存预算(KB)，超过时淘汰不再使用的inode和干净的数据块
+#define NFS_READAHEAD_MIN       4   // 顺序读开始时的预读窗口(块)，之后每次顺序读翻倍
+#define NFS_READAHEAD_MAX       64   // 预读窗口的默认上限(KB)
+#define NFS_READAHEAD_QUEUE     64   // 异步预读队列长度，队列满时丢弃新的预读请求
+
+#define NFS_SLAB_CHUNK_SZ       16384   // 对象池每次向malloc申请的内存大小，目录项和inode从中顺序切分
+#define NFS_NAME_CHUNK_SZ       1024   // 目录的文件名存储区每次申请的大小
+
+#define NFS_BUF_NUM             256   // 块缓存容量，可缓存256个逻辑块(256KB)
+#define NFS_WRITE_CLUSTER       32   // 淘汰脏块时连同块号相邻的脏块一起写回的最大块数
+#define NFS_BUF_HASH_SZ         512   // 块缓存哈希桶数量
 
 // 磁盘布局
-// sizeof(struct nfs_inode) = 104
-// 设计一个逻辑块存储8个索引节点，一个文件最多直接索引6个逻辑块来填写文件数据，则8个文件需要的存储容量是8 * 6 + 1 = 49KB
-// 4MB的磁盘最多可以存放的文件个数是(4MB / 49KB) * 8 = 664个文件，需要4MB / 49KB = 83个逻辑块存储索引节点
+// 4MB的磁盘共4096个逻辑块，最多存放664个文件(inode数量)，除去元数据和日志后约3863个数据块
+// 一个逻辑块存储4个索引节点(每个索引节点槽256B，其中可内嵌NFS_INLINE_MAX字节的小文件内容)，需要166个逻辑块存储索引节点
+// 文件的数据块用extent(起始块号, 长度)描述，不再限制单个文件的数据块数量
+// 索引节点之后是元数据日志区，一个事务最多包含64 - 2 = 62个元数据块
 #define NFS_SUPER_BLOCK_NUM     1   // 超级块占用1个逻辑块
 #define NFS_INODE_MAP_BLOCK_NUM 1   // 索引节点位图占用1个逻辑块
 #define NFS_DATA_MAP_BLOCK_NUM  1   // 数据块位图占用1个逻辑块
-#define NFS_INODE_BLOCK_NUM     83   // 需要83个逻辑块存储索引节点
-#define NFS_DATA_BLOCK_NUM      4010   // 还剩下4096 - 1 - 1 - 1 - 83 = 4010个逻辑块作为数据块
+#define NFS_INODE_BLOCK_NUM     166   // 需要166个逻辑块存储索引节点
+#define NFS_JOURNAL_BLOCK_NUM   64   // 日志区占用64个逻辑块
+#define NFS_DATA_BLOCK_NUM      3863   // 还剩下4096 - 1 - 1 - 1 - 166 - 64 = 3863个逻辑块作为数据块
 /******************************************************************************
 * SECTION: Type def
 *******************************************************************************/
@@ -62,19 +114,29 @@ typedef enum nfs_file_type {
 #define NFS_DRIVER()                    (nfs_super.fd)
 
 #define NFS_BLKS_SZ(blks)               ((blks) * 2 * NFS_IO_SZ())   // 一个逻辑块的大小为2个磁盘IO大小，即1024B
-#define NFS_ASSIGN_FNAME(psfs_dentry, _fname)\ 
-                                        memcpy(psfs_dentry->name, _fname, strlen(_fname))
+#define NFS_BLK_NO(offset)              ((offset) / NFS_BLKS_SZ(1))   // 磁盘偏移所在的逻辑块号
 
 // inode索引在磁盘中的偏移量(大小为nfs_inode_d，因为只有从磁盘中读和往磁盘中写时用到该函数) (修改逻辑块内可存放的inode_d数量只需修改NFS_INO_OFS和NFS_INODE_BLOCK_NUM)
-#define NFS_INO_OFS(ino)                (nfs_super.inode_offset + NFS_BLKS_SZ(ino / 8) + (ino % 8) * sizeof(struct nfs_inode_d))
+#define NFS_INO_OFS(ino)                (nfs_super.inode_offset + NFS_BLKS_SZ((ino) / NFS_INODE_PER_BLK) + ((ino) % NFS_INODE_PER_BLK) * NFS_INODE_D_SZ)
 // 数据块起始地址  
 #define NFS_DATA_OFS(ino)               (nfs_super.data_offset + NFS_BLKS_SZ(ino))                             
+#define NFS_DATA_BLK(data_no)           (NFS_BLK_NO(nfs_super.data_offset) + (data_no))   // 数据块对应的逻辑块号
+#define NFS_EXTENT_PER_BLK()            (NFS_BLKS_SZ(1) / sizeof(struct nfs_extent))   // 一个溢出extent块可存放的extent数量
+#define NFS_EXTENT_MAX()                (NFS_EXTENT_INLINE + NFS_EXTENT_PER_BLK())   // 一个文件最多的extent数量
+#define NFS_DIRENT_SZ(name_len)         NFS_ROUND_UP(sizeof(struct nfs_dirent_d) + (name_len), 4)   // 变长目录项记录的长度(4字节对齐)
 
 #define NFS_ROUND_DOWN(value, round)    ((value) % (round) == 0 ? (value) : ((value) / (round)) * (round))   // 不超过value中round的最大倍数
 #define NFS_ROUND_UP(value, round)      ((value) % (round) == 0 ? (value) : ((value) / (round) + 1) * (round))   // 不小于value中round的最小倍数
 
+// 无锁读路径访问的字段(目录项链表、哈希索引、size/dir_cnt/block_num等)由写者在inode写锁下用NFS_STORE发布，读者用NFS_LOAD读取
+#define NFS_LOAD(field)                 __atomic_load_n(&(field), __ATOMIC_ACQUIRE)
+#define NFS_STORE(field, value)         __atomic_store_n(&(field), (value), __ATOMIC_RELEASE)
+
+#define NFS_FH(fi)                      ((struct nfs_fhandle *)(uintptr_t)(fi)->fh)   // 从fuse_file_info中取出句柄
+
 #define NFS_IS_DIR(pinode)              (pinode->dentry->ftype == NFS_DIR)
 #define NFS_IS_REG(pinode)              (pinode->dentry->ftype == NFS_REG_FILE)
+#define NFS_IS_INLINE(pinode)           (NFS_IS_REG(pinode) && (pinode)->block_num == 0)   // 内容内嵌在inode槽中，内存中放在block_pointer[0]
 /******************************************************************************
 * SECTION: FS Specific Structure - In memory structure
 *******************************************************************************/
@@ -85,6 +147,176 @@ struct nfs_inode_d;
 
 struct custom_options {
 	const char*        device;
+	int                dcache_size;   // 路径缓存容量
+	int                flush_interval;   // 后台写回周期(秒)，0表示不启动后台写回线程
+	int                dirty_limit;   // 脏数据上限(KB)，0表示不限制
+	int                mem_limit;   // inode缓存内存预算(KB)，0表示不限制
+	int                cache_timeout;   // 内核属性及目录项缓存的有效期(秒)，0表示使用FUSE的默认值
+	int                max_write;   // 单次写请求上限(KB)，0表示使用内核默认值(不启用big_writes，每次一页)
+	int                max_readahead;   // 预读上限(KB)，0表示使用内核提出的值
+	int                async_read;   // 是否允许内核并发发送同一文件的读请求
+	int                splice;   // 是否用splice在/dev/fuse与缓冲区之间传递读写数据
+	int                writeback_cache;   // 是否启用内核写回缓存，需要libfuse支持
+	int                readahead;   // 顺序读预读窗口上限(KB)，0表示不预读
+	double             entry_timeout;   // 低层接口的目录项缓存有效期(秒)，-o entry_timeout=，高层接口由libfuse解析
+	double             attr_timeout;   // 低层接口的属性缓存有效期(秒)，-o attr_timeout=
+	double             negative_timeout;   // 低层接口的负目录项缓存有效期(秒)，-o negative_timeout=，0表示不缓存
+};
+
+// 路径缓存条目，dentry为NULL表示该路径不存在(负缓存)
+struct nfs_dcache_entry {
+    char*              path;   // 完整路径
+    uint32_t           hash;   // 路径哈希值
+    struct nfs_dentry* dentry;   // 路径对应的目录项
+    int                referenced;   // 上次淘汰扫描以来是否被查询过(CLOCK)，查询时不移动LRU链表
+    struct nfs_dcache_entry* prev;   // LRU链表前驱
+    struct nfs_dcache_entry* next;   // LRU链表后继
+    struct nfs_dcache_entry* hnext;   // 哈希链表后继，查询时无锁遍历
+};
+
+// 完整路径 -> 目录项的缓存，供getattr使用
+struct nfs_dcache {
+    struct nfs_dcache_entry* hash[NFS_DCACHE_HASH_SZ];
+    struct nfs_dcache_entry  lru;   // LRU链表哨兵，lru.next为最近使用
+    int cnt;   // 当前条目数
+    int max;   // 最大条目数
+
+    int hit;   // 正缓存命中次数
+    int neg_hit;   // 负缓存命中次数
+    int miss;   // 未命中次数
+    int evict;   // 因容量不足淘汰的次数
+    int invalidate;   // 因目录结构变化失效的次数
+
+    uint32_t gen;   // 每次失效时递增，查找期间发生过失效的结果不加入缓存
+
+    pthread_mutex_t lock;   // 串行化修改路径缓存的操作，查询不加锁
+};
+
+// 位图分配器，按64位字扫描位图(位序与按字节访问一致，要求小端序)
+struct nfs_bitmap {
+    uint64_t* words;   // 位图内容，与nfs_super.map_inode/map_data共用内存
+    int       nbits;   // 有效位数，超出部分视为已占用
+    int       nwords;   // 有效字数
+    int       free;   // 空闲位数
+    int       cursor;   // next-fit游标，下次分配从该位开始查找
+    boolean   dirty;   // 上次写回后是否被修改
+    boolean   freed;   // 上次写回后是否释放过位，此时不能只写回单个inode占用的位
+};
+
+// open/opendir时保存在fi->fh中的句柄，持有inode的一个引用
+struct nfs_fhandle {
+    struct nfs_dentry* dentry;   // 打开的目录项
+    struct nfs_inode*  inode;   // 打开的inode
+    off_t              pos;   // readdir游标，即下一个要输出的是第几个目录项
+    struct nfs_dentry* next;   // 游标处的目录项，NULL表示已到末尾
+    int                ra_next;   // 顺序读时下一次读取的起始块(文件内逻辑块号)
+    int                ra_win;   // 当前预读窗口(块)，顺序读时翻倍直到上限，随机读时收缩为0
+    int                ra_end;   // 已提交预读的范围末尾(不含)
+    int                wb_err;   // 已向该句柄报告过的写回错误序号
+};
+
+// 块缓存中的一个缓冲区，对应磁盘上的一个逻辑块
+struct nfs_buf {
+    int      blk;   // 缓存的逻辑块号
+    int      flags;   // NFS_FLAG_BUF_OCCUPY: 缓冲区有效; NFS_FLAG_BUF_DIRTY: 缓冲区需写回
+    uint8_t* data;   // 逻辑块内容
+    struct nfs_buf* prev;   // LRU链表前驱(靠近最近使用端)
+    struct nfs_buf* next;   // LRU链表后继(靠近最久未使用端)
+    struct nfs_buf* hnext;   // 哈希链表后继
+};
+
+// 块缓存，按逻辑块号索引，LRU淘汰，写回式
+struct nfs_bcache {
+    struct nfs_buf*  bufs;   // 所有缓冲区
+    uint8_t*         data;   // 所有缓冲区的数据区
+    int              nbufs;   // 缓冲区数量
+    struct nfs_buf*  hash[NFS_BUF_HASH_SZ];   // 逻辑块号 -> 缓冲区
+    struct nfs_buf   lru;   // LRU链表哨兵，lru.next为最近使用，lru.prev为最久未使用
+    struct nfs_buf** queue;   // 写回时按块号排序的脏块，容量为nbufs
+
+    int hit;   // 命中次数
+    int miss;   // 未命中次数
+    int dev_read;   // 读设备的块数
+    int dev_write;   // 写设备的块数
+    int dev_seek;   // 写设备时的寻道次数，块号连续的一段脏块只寻道一次
+    int syncs;   // 有脏块需要写回的sync次数
+    int sync_blks;   // sync写回的块数，即按块写回时的寻道次数
+    int sync_runs;   // sync时合并成的连续段数，即实际的寻道次数
+
+    int meta_cnt;   // 标记为NFS_FLAG_BUF_META的缓冲区数量
+    int meta_max;   // meta_cnt的上限，即一个事务最多包含的元数据块数
+
+    pthread_mutex_t lock;   // 可重入锁，持有期间返回的缓冲区不会被淘汰
+};
+
+// 定长对象池，见nfs_slab.c
+struct nfs_slab_chunk {
+    struct nfs_slab_chunk* next;
+};
+
+struct nfs_slab {
+    const char*            name;
+    int                    obj_sz;   // 对象大小，按16字节对齐
+    int                    per_chunk;   // 每个chunk切分出的对象数
+    struct nfs_slab_chunk* chunks;   // 所有chunk，卸载时整体释放
+    uint8_t*               cursor;   // 当前chunk中下一个未切分的对象
+    int                    left;   // 当前chunk中剩余未切分的对象数
+    void*                  free_list;   // 释放的对象，用对象的前8字节串起
+    int                    in_use;   // 使用中的对象数
+    int                    peak;   // in_use的峰值
+    int                    chunk_cnt;
+    pthread_mutex_t        lock;
+};
+
+// inode缓存，见nfs_icache.c
+struct nfs_icache {
+    struct nfs_inode* hand;   // CLOCK指针，指向可淘汰inode环形链表中的下一个候选，受load_lock保护
+    int  cnt;   // 链表中的inode数
+    long mem;   // inode、目录项和数据块缓冲区占用的内存(字节)
+    long max;   // 内存预算，LONG_MAX表示不限制
+    int  shrinking;   // 是否有线程正在回收
+    int  evict;   // 淘汰的inode数
+    int  drop;   // 丢弃的干净数据块数
+};
+
+// 异步预读队列，见nfs_readahead.c
+struct nfs_readahead {
+    int             max_win;   // 预读窗口上限(块)，0表示不预读
+    int             blk[NFS_READAHEAD_QUEUE];   // 待预读的起始逻辑块号
+    int             cnt[NFS_READAHEAD_QUEUE];   // 待预读的块数
+    int             head;   // 下一个取出的请求
+    int             tail;   // 下一个放入的位置
+    boolean         on;   // 预读线程是否在运行
+    boolean         stop;   // 通知预读线程退出
+    pthread_t       thread;
+    pthread_mutex_t lock;   // 保护队列和stop
+    pthread_cond_t  cond;   // 唤醒预读线程
+    int             submit;   // 提交的请求数
+    int             drop;   // 队列满时丢弃的请求数
+};
+
+// 元数据日志，见nfs_journal.c
+struct nfs_journal {
+    int offset;   // 日志区起始逻辑块号
+    int blks;   // 日志区块数
+    int head;   // 下一个事务写入的位置(日志区内的块号)，受块缓存锁保护
+    uint32_t seq;   // 下一个事务的序号
+
+    uint32_t tid_req;   // 已收到的提交请求数
+    uint32_t tid_done;   // 已持久化的提交请求数
+    boolean  committing;   // 是否有线程正在提交
+    pthread_mutex_t lock;   // 保护以上三个字段
+    pthread_cond_t  cond;   // 一次提交结束
+    pthread_rwlock_t txn_lock;   // 修改文件系统的操作持读锁，提交时持写锁
+
+    int commits;   // 写入日志的事务数
+    int file_commits;   // 只提交一个文件(fsync/release)的次数
+    int logged;   // 写入日志的块数
+    int checkpoints;   // 检查点次数
+    int splits;   // 元数据超出一个事务而拆分提交的次数
+
+    int* live;   // 日志中所有镜像对应的逻辑块号，检查点时清空
+    int  live_cnt;
 };
 
 struct nfs_super {
@@ -100,11 +332,13 @@ struct nfs_super {
     uint8_t* map_inode;   // inode位图
     int map_inode_blks;   // inode位图所占的数据块
     int map_inode_offset;   // inode位图的起始地址
+    struct nfs_bitmap inode_bm;   // inode位图分配器
 
     int max_data;   // 数据块数目
     uint8_t* map_data;   // 数据块位图
     int map_data_blks;   // 数据块位图所占的数据块
     int map_data_offset;   // 数据块位图的起始地址
+    struct nfs_bitmap data_bm;   // 数据块位图分配器
 
     int inode_offset;   // 索引节点块的起始地址
     int data_offset;   // 数据块的起始地址
@@ -112,7 +346,56 @@ struct nfs_super {
     boolean is_mounted;
 
     struct nfs_dentry* root_dentry;   // 根目录
+    struct nfs_inode*  dirty_inodes;   // 脏inode链表，按变脏的先后排列，sync时只写回链表上的inode
+    struct nfs_inode*  dirty_tail;   // 脏inode链表末尾，新变脏的inode追加在这里
+    int dirty_blks;   // 尚未写回的数据块(文件内容和目录项块)数量
+    int dirty_bg;   // 脏块数超过该值时唤醒后台写回线程
+    int dirty_limit;   // 脏块数超过该值时前台写操作等待写回，INT_MAX表示不限制
+    int flush_interval;   // 后台写回周期(秒)
+
+    pthread_t       flusher;   // 后台写回线程
+    boolean         flusher_on;   // 后台写回线程是否在运行
+    boolean         flush_stop;   // 通知后台写回线程退出
+    boolean         flush_kicked;   // 有人要求立即写回
+    pthread_mutex_t flush_lock;   // 保护以上三个标志
+    pthread_cond_t  flush_cond;   // 唤醒后台写回线程
+    pthread_cond_t  flush_done;   // 一轮写回结束，唤醒等待的前台写操作
+    int             wb_err;   // 写回错误序号，每次提交失败加一，flush和fsync据此报告其间发生的错误
+
+    pthread_mutex_t bm_lock;   // 保护inode位图和数据块位图
+    pthread_mutex_t dirty_lock;   // 保护脏inode链表及inode的dirty字段
+    pthread_mutex_t load_lock;   // 保证同一个inode只从磁盘读入一次
+
+    struct nfs_bcache  bcache;   // 块缓存
+    struct nfs_dcache  dcache;   // 路径缓存
+    struct nfs_journal journal;   // 元数据日志
+    struct nfs_icache  icache;   // inode缓存
+    struct nfs_readahead ra;   // 异步预读
+    struct nfs_slab    dentry_slab;   // 目录项对象池
+    struct nfs_slab    inode_slab;   // inode对象池
+    struct nfs_inode** ll_inodes;   // 低层接口按inode号索引被内核引用的inode，见nfs_ll.c
+};
+
+// 目录哈希索引的一个槽，采用开放寻址(线性探测)
+struct nfs_dir_slot {
+    uint32_t           hash;   // 文件名哈希值
+    uint32_t           len;   // 文件名长度，与hash一起在访问目录项之前过滤
+    struct nfs_dentry* dentry;   // 子目录项，NULL表示空槽
+};
 
+// 目录的文件名存储区，子目录项的文件名依次追加，随目录inode一起释放
+struct nfs_name_chunk {
+    struct nfs_name_chunk* next;
+    int                    used;
+    int                    cap;
+    char                   data[];
+};
+
+// 目录哈希索引，扩容时整体替换为新表并通过epoch回收旧表
+struct nfs_dir_htab {
+    int sz;   // 槽数(2的幂)
+    int cnt;   // 目录项数
+    struct nfs_dir_slot slots[];
 };
 
 struct nfs_inode {
@@ -121,35 +404,46 @@ struct nfs_inode {
     int size;   // 文件已占用空间大小
     int  dir_cnt;   // 目录项个数
     struct nfs_dentry* dentry;    // 指向该inode的dentry
-    struct nfs_dentry* dentrys;   // 所有目录项
+    struct nfs_dentry* dentrys;   // 所有目录项，顺序与磁盘上的目录项顺序一致
+    struct nfs_dentry* dentrys_tail;   // 最后一个目录项，新目录项追加在末尾
+    struct nfs_dir_htab* htab;   // 子目录项的哈希索引，目录读入或创建时建立
+    struct nfs_name_chunk* names;   // 子目录项文件名的存储区
+    int ref;   // 引用计数，即打开该inode的句柄数，使用低层接口时还包括内核的lookup计数
     int block_num;   // 已分配数据块数量
-    int block_index[6];   // 数据块在磁盘中的块号 
-    uint8_t* block_pointer[6];   // 数据块指针(假设每个文件最多直接索引6个逻辑块来填写文件数据)
+    struct nfs_extent* extents;   // 数据块的extent映射，按文件内逻辑块顺序排列
+    int extent_num;   // extent数量
+    int extent_cap;   // extents数组容量
+    int extent_blk;   // 溢出extent块的数据块号，-1表示没有
+    uint8_t** block_pointer;   // 数据块指针，按文件内逻辑块号索引
+    uint8_t*  block_dirty;   // block_dirty[i]非0表示第i个数据块需要写回(目录为第i个目录项块)
+    int block_cap;   // block_pointer/block_dirty数组容量
+    struct timespec atime;   // 访问时间，只在创建和utimens时更新(noatime)
+    struct timespec mtime;   // 内容修改时间，目录为增加目录项的时间
+    struct timespec ctime;   // inode修改时间
+    int dirty;   // NFS_INODE_DIRTY_META | NFS_INODE_DIRTY_DATA
+    time_t dirty_time;   // 变脏的时刻，用于后台写回判断是否过期
+    struct nfs_inode* dirty_prev;   // 脏inode链表
+    struct nfs_inode* dirty_next;
+    int referenced;   // CLOCK访问标记，无锁读路径也会置位
+    struct nfs_inode* lru_prev;   // 可淘汰inode的环形链表，见nfs_icache.c
+    struct nfs_inode* lru_next;
+    pthread_rwlock_t lock;   // 串行化对inode的修改，路径查找和getattr/readdir不加锁，加锁顺序见nfs.h
 };
 
 struct nfs_dentry {
-    char     name[MAX_NAME_LEN];
+    const char* name;   // 指向所在目录的文件名存储区，以'\0'结尾
+    uint16_t name_len;
+    uint32_t hash;   // 文件名哈希值，建立和扩容目录哈希索引时不必重新计算
     uint32_t ino;
+    int      blk;   // 在所在目录的第几个目录项块中
     /* TODO: Define yourself */
     struct nfs_dentry* parent;   // 父亲Inode的dentry 
     struct nfs_dentry* brother;   // 兄弟 
-    struct nfs_inode*  inode;   // 指向inode
+    struct nfs_inode*  inode;   // 指向inode，inode被淘汰后为NULL，再次访问时重新读入
     NFS_FILE_TYPE      ftype;
+    int                detached;   // 所在目录的inode已被淘汰，该目录项等待epoch回收
 };
 
-// 函数功能：创建目录项
-static inline struct nfs_dentry* new_dentry(char * fname, NFS_FILE_TYPE ftype) {
-    struct nfs_dentry * dentry = (struct nfs_dentry *)malloc(sizeof(struct nfs_dentry));
-    memset(dentry, 0, sizeof(struct nfs_dentry));
-    NFS_ASSIGN_FNAME(dentry, fname);
-    dentry->ftype   = ftype;
-    dentry->ino     = -1;
-    dentry->inode   = NULL;
-    dentry->parent  = NULL;
-    dentry->brother = NULL; 
-    return dentry;                                            
-}
-
 /******************************************************************************
 * SECTION: FS Specific Structure - Disk structure
 *******************************************************************************/
@@ -168,6 +462,31 @@ struct nfs_super_d{
     int inode_offset;   // 索引节点块的起始地址
     int data_offset;   // 数据块的起始地址
 
+    uint32_t version;   // 磁盘格式版本
+
+    int journal_offset;   // 日志区的起始地址
+    int journal_blks;   // 日志区所占的逻辑块
+};
+
+// 日志头，位于日志区第一个块
+struct nfs_journal_sb_d {
+    uint32_t magic;
+    uint32_t seq;   // 日志中第一个有效事务的序号
+};
+
+// 事务头，之后紧跟nr个元数据块的镜像
+struct nfs_journal_txn_d {
+    uint32_t magic;
+    uint32_t seq;   // 事务序号，重放时必须连续
+    int      nr;   // 镜像块数
+    uint32_t csum;   // 事务头(csum为0时)和所有镜像的校验和
+    int      blks[];   // 每个镜像对应的逻辑块号
+};
+
+// 一段连续的数据块
+struct nfs_extent {
+    int start;   // 起始数据块号
+    int len;   // 连续数据块数量
 };
 
 struct nfs_inode_d{
@@ -175,14 +494,33 @@ struct nfs_inode_d{
     int size;   // 文件已占用空间大小
     int  dir_cnt;   // 目录项个数
     int block_num;   // 已分配数据块数量
-    int block_index[6];   // 数据块在磁盘中的块号
     NFS_FILE_TYPE      ftype;   // 文件类型
+    int extent_num;   // extent数量
+    int extent_blk;   // 溢出extent块的数据块号，-1表示没有
+    uint32_t atime_ns;   // 时间戳的纳秒部分，放在秒之前使int64_t按8字节对齐
+    uint32_t mtime_ns;
+    uint32_t ctime_ns;
+    int64_t  atime;   // 时间戳(秒)
+    int64_t  mtime;
+    int64_t  ctime;
+    struct nfs_extent extents[NFS_EXTENT_INLINE];   // 前NFS_EXTENT_INLINE个extent
+    uint8_t inline_data[NFS_INLINE_MAX];   // 没有数据块的普通文件的内容
 };
+_Static_assert(sizeof(struct nfs_inode_d) <= NFS_INODE_D_SZ, "nfs_inode_d must fit in an inode slot");
 
-struct nfs_dentry_d{
-    char     name[MAX_NAME_LEN];
-    uint32_t ino;
-    NFS_FILE_TYPE      ftype;   // 文件类型
+// 目录项块头，之后紧跟cnt条变长目录项记录
+struct nfs_dir_blk_d {
+    uint16_t magic;   // NFS_DIR_BLK_MAGIC
+    uint16_t version;   // NFS_DIR_BLK_VERSION
+    uint16_t cnt;   // 块内目录项个数
+    uint16_t used;   // 块内已用字节数(含块头)
+};
 
+// 变长目录项记录，之后紧跟name_len字节的文件名(不以'\0'结尾)，整条记录按4字节对齐
+struct nfs_dirent_d {
+    uint32_t ino;
+    uint8_t  ftype;   // 文件类型
+    uint8_t  name_len;
+    uint16_t rec_len;   // 整条记录的长度，即NFS_DIRENT_SZ(name_len)
 };
 #endif /* _TYPES_H_ */
\ No newline at end of file
@@ -12,6 +12,17 @@
 *******************************************************************************/
 static const struct fuse_opt option_spec[] = {		/* 用于FUSE文件系统解析参数 */
 	OPTION("--device=%s", device),
+	OPTION("--dcache_size=%d", dcache_size),
+	OPTION("--flush_interval=%d", flush_interval),
+	OPTION("--dirty_limit=%d", dirty_limit),
+	OPTION("--mem_limit=%d", mem_limit),
+	OPTION("--cache_timeout=%d", cache_timeout),
+	OPTION("--max_write=%d", max_write),
+	OPTION("--max_readahead=%d", max_readahead),
+	OPTION("--async_read=%d", async_read),
+	OPTION("--splice=%d", splice),
+	OPTION("--writeback_cache=%d", writeback_cache),
+	OPTION("--readahead=%d", readahead),
 	FUSE_OPT_END
 };
 
@@ -19,7 +30,9 @@ struct custom_options nfs_options;			 /* 全局选项 */
 struct nfs_super nfs_super; 
 /******************************************************************************
 * SECTION: FUSE操作定义
+* 默认使用按inode号访问的低层接口(nfs_ll.c)，cmake -DNFS_HIGH_LEVEL=ON时使用以下按路径访问的高层接口
 *******************************************************************************/
+#ifdef NFS_HIGH_LEVEL
 static struct fuse_operations operations = {
 	.init = nfs_init,						 /* mount文件系统 */		
 	.destroy = nfs_destroy,				 /* umount文件系统 */
@@ -27,29 +40,120 @@ static struct fuse_operations operations = {
 	.getattr = nfs_getattr,				 /* 获取文件属性，类似stat，必须完成 */
 	.readdir = nfs_readdir,				 /* 填充dentrys */
 	.mknod = nfs_mknod,					 /* 创建文件，touch相关 */
-	.write = NULL,								  	 /* 写入文件 */
-	.read = NULL,								  	 /* 读文件 */
-	.utimens = nfs_utimens,				 /* 修改时间，忽略，避免touch报错 */
-	.truncate = NULL,						  		 /* 改变文件大小 */
+	.write = nfs_write,					 /* 写入文件 */
+	.read = nfs_read,						 /* 读文件 */
+	.utimens = nfs_utimens,				 /* 修改访问/修改时间 */
+	.truncate = nfs_truncate,				 /* 改变文件大小 */
 	.unlink = NULL,							  		 /* 删除文件 */
 	.rmdir	= NULL,							  		 /* 删除目录， rm -r */
 	.rename = NULL,							  		 /* 重命名，mv */
 
-	.open = NULL,							
-	.opendir = NULL,
+	.open = nfs_open,						 /* 打开文件，保存句柄 */
+	.flush = nfs_flush,						 /* close时报告写回失败 */
+	.release = nfs_release,				 /* 关闭文件 */
+	.opendir = nfs_opendir,				 /* 打开目录，保存句柄及readdir游标 */
+	.releasedir = nfs_releasedir,			 /* 关闭目录 */
+	.fsync = nfs_fsync,						 /* 文件持久化，只写回该文件 */
+	.fsyncdir = nfs_fsyncdir,				 /* 目录持久化，提交日志 */
 	.access = NULL
 };
+#endif
+/******************************************************************************
+* SECTION: 辅助函数
+*******************************************************************************/
+/**
+ * @brief 根据目录项填充文件属性
+ * 
+ * @param dentry 目录项，inode尚未读入时读入，调用者需处于epoch临界区内
+ * @param nfs_stat 返回状态
+ * @return int inode读入失败时返回-NFS_ERROR_IO
+ */
+int nfs_fill_stat(struct nfs_dentry* dentry, struct stat * nfs_stat) {
+	struct nfs_inode* inode = nfs_dentry_inode(dentry);   // 只取一次，dentry->inode随时可能被淘汰
+
+	if (inode == NULL) {
+		return -NFS_ERROR_IO;
+	}
+	memset(nfs_stat, 0, sizeof(struct stat));
+	// 不加锁，各字段单独读取，与写者并发时可能读到写入前或写入后的值
+	if (NFS_IS_DIR(inode)) {   // inode对应的是目录，设置其属性
+		nfs_stat->st_mode = S_IFDIR | NFS_DEFAULT_PERM;
+		nfs_stat->st_size = NFS_LOAD(inode->size);
+	}
+	else if (NFS_IS_REG(inode)) {   // inode对应的是普通文件，设置其属性
+		nfs_stat->st_mode = S_IFREG | NFS_DEFAULT_PERM;
+		nfs_stat->st_size = NFS_LOAD(inode->size);
+	}
+	// else if (SFS_IS_SYM_LINK(dentry->inode)) {   // 实验无需考虑软链接和硬链接的实现
+	// 	sfs_stat->st_mode = S_IFLNK | SFS_DEFAULT_PERM;
+	// 	sfs_stat->st_size = dentry->inode->size;
+	// }
+
+	nfs_stat->st_nlink = 1;
+	nfs_stat->st_uid 	 = getuid();
+	nfs_stat->st_gid 	 = getgid();
+	nfs_stat->st_atim.tv_sec  = NFS_LOAD(inode->atime.tv_sec);
+	nfs_stat->st_atim.tv_nsec = NFS_LOAD(inode->atime.tv_nsec);
+	nfs_stat->st_mtim.tv_sec  = NFS_LOAD(inode->mtime.tv_sec);
+	nfs_stat->st_mtim.tv_nsec = NFS_LOAD(inode->mtime.tv_nsec);
+	nfs_stat->st_ctim.tv_sec  = NFS_LOAD(inode->ctime.tv_sec);
+	nfs_stat->st_ctim.tv_nsec = NFS_LOAD(inode->ctime.tv_nsec);
+	nfs_stat->st_blksize = NFS_BLKS_SZ(1);
+	nfs_stat->st_blocks	= NFS_LOAD(inode->block_num) * (NFS_BLKS_SZ(1) / 512);   // st_blocks以512B为单位
+
+	if (dentry == nfs_super.root_dentry) {
+		nfs_stat->st_size	= nfs_super.sz_usage; 
+		nfs_stat->st_blocks = NFS_DISK_SZ() / (NFS_IO_SZ() * 2);
+		nfs_stat->st_nlink  = 2;		/* !特殊，根目录link数为2 */
+	}
+	return NFS_ERROR_NONE;
+}
 /******************************************************************************
 * SECTION: 必做函数实现
 *******************************************************************************/
+/**
+ * @brief 按挂载选项与内核协商连接参数，只请求内核支持的能力，超出libfuse缓冲区的max_write由libfuse截断
+ * 
+ * @param conn 内核提出的参数，返回时为希望使用的参数
+ */
+void nfs_conn_setup(struct fuse_conn_info* conn) {
+	if (nfs_options.max_write > 0) {
+		conn->max_write = nfs_options.max_write * 1024;
+		conn->want     |= conn->capable & FUSE_CAP_BIG_WRITES;   // 否则内核每个写请求只发送一页
+	}
+	if (nfs_options.max_readahead > 0 && nfs_options.max_readahead * 1024 < (int)conn->max_readahead) {
+		conn->max_readahead = nfs_options.max_readahead * 1024;
+	}
+	if (nfs_options.async_read) {
+		conn->want |= conn->capable & FUSE_CAP_ASYNC_READ;
+	}
+	else {
+		conn->async_read = 0;
+		conn->want      &= ~FUSE_CAP_ASYNC_READ;
+	}
+	if (nfs_options.splice) {
+		conn->want |= conn->capable & (FUSE_CAP_SPLICE_READ | FUSE_CAP_SPLICE_WRITE | FUSE_CAP_SPLICE_MOVE);
+	}
+	if (nfs_options.writeback_cache) {
+#ifdef FUSE_CAP_WRITEBACK_CACHE
+		conn->want |= conn->capable & FUSE_CAP_WRITEBACK_CACHE;
+#else
+		NFS_DBG("[%s] writeback_cache is not supported by this libfuse\n", __func__);
+#endif
+	}
+}
+
 /**
  * @brief 挂载（mount）文件系统
  * 
- * @param conn_info 可忽略，一些建立连接相关的信息 
+ * @param conn_info 一些建立连接相关的信息，按挂载选项协商读写请求大小等参数
  * @return void*
  */
 void* nfs_init(struct fuse_conn_info * conn_info) {
 	/* TODO: 在这里进行挂载 */
+	if (conn_info != NULL) {
+		nfs_conn_setup(conn_info);
+	}
 	if (nfs_mount(nfs_options) != NFS_ERROR_NONE) {
         NFS_DBG("[%s] mount error\n", __func__);
 		fuse_exit(fuse_get_context()->fuse);
@@ -91,25 +195,38 @@ int nfs_mkdir(const char* path, mode_t mode) {
 	/* TODO: 解析路径，创建目录 */
 	(void)mode;
 	boolean is_find, is_root;
-	char* fname;
-	struct nfs_dentry* last_dentry = nfs_lookup(path, &is_find, &is_root);   // 首先寻找上级目录项
-	struct nfs_dentry* dentry;
-	struct nfs_inode*  inode;
+	struct nfs_dentry* last_dentry;
+	int                ret;
 
+	// 在解析路径和加inode锁之前进入，提交时看到的是完整的操作，期间inode缓存也不会回收找到的目录项
+	if (strlen(nfs_get_fname(path)) > MAX_NAME_LEN) {   // 文件名过长时不截断
+		return -NFS_ERROR_NAMETOOLONG;
+	}
+	nfs_journal_begin();
+	last_dentry = nfs_lookup(path, &is_find, &is_root);   // 首先寻找上级目录项
+	if (last_dentry == NULL) {   // 路径上的inode读入失败
+		nfs_journal_end();
+		return -NFS_ERROR_IO;
+	}
 	if (is_find) {   // 目录已存在，报错
+		nfs_journal_end();
 		return -NFS_ERROR_EXISTS;
 	}
 
 	// 上级目录项是普通文件，不能创建目录
 	if (NFS_IS_REG(last_dentry->inode)) {
+		nfs_journal_end();
 		return -NFS_ERROR_UNSUPPORTED;
 	}
 
-	fname  = nfs_get_fname(path);
-	dentry = new_dentry(fname, NFS_DIR);   // 创建目录
-	dentry->parent = last_dentry;
-	inode  = nfs_alloc_inode(dentry);   // 给目录分配一个inode
-	nfs_alloc_dentry(last_dentry->inode, dentry);   // 将denry插入到上级目录的inode中
+	ret = nfs_create(last_dentry->inode, nfs_get_fname(path), NFS_DIR, NULL);   // 创建目录并插入到上级目录中
+	nfs_journal_end();
+	if (ret < 0) {
+		return ret;
+	}
+	nfs_dcache_invalidate(path);   // 该路径的负缓存失效
+	nfs_flush_throttle();   // 脏数据过多时等待写回，此时已不持有任何inode锁
+	nfs_icache_balance();
 	
 	return NFS_ERROR_NONE;
 	// return 0;
@@ -125,39 +242,33 @@ int nfs_mkdir(const char* path, mode_t mode) {
 int nfs_getattr(const char* path, struct stat * nfs_stat) {
 	/* TODO: 解析路径，获取Inode，填充nfs_stat，可参考/fs/simplefs/sfs.c的sfs_getattr()函数实现 */
 	boolean	is_find, is_root;
-	// 路径解析，获取路径对应的目录项
-	struct nfs_dentry* dentry = nfs_lookup(path, &is_find, &is_root);
-	if (is_find == FALSE) {
-		return -NFS_ERROR_NOTFOUND;
-	}
-
-	if (NFS_IS_DIR(dentry->inode)) {   // inode对应的是普通文件，设置其属性
-		nfs_stat->st_mode = S_IFDIR | NFS_DEFAULT_PERM;
-		nfs_stat->st_size = dentry->inode->dir_cnt * sizeof(struct nfs_dentry_d);
+	struct nfs_dentry* dentry;
+	uint32_t           gen;
+	int                ret;
+	// 先查路径缓存，未命中再进行路径解析，获取路径对应的目录项，目录项在临界区内不会被inode缓存回收
+	nfs_epoch_enter();
+	if (!nfs_dcache_lookup(path, &dentry)) {
+		gen    = nfs_dcache_gen();
+		dentry = nfs_lookup(path, &is_find, &is_root);
+		if (dentry == NULL) {   // 路径上的inode读入失败，不能作为负缓存
+			nfs_epoch_exit();
+			return -NFS_ERROR_IO;
+		}
+		nfs_dcache_add(path, is_find ? dentry : NULL, gen);
+		if (is_find == FALSE) {
+			nfs_epoch_exit();
+			return -NFS_ERROR_NOTFOUND;
+		}
 	}
-	else if (NFS_IS_REG(dentry->inode)) {   // inode对应的是目录，设置其属性
-		nfs_stat->st_mode = S_IFREG | NFS_DEFAULT_PERM;
-		nfs_stat->st_size = dentry->inode->size;
+	if (dentry == NULL) {   // 负缓存命中，路径不存在
+		nfs_epoch_exit();
+		return -NFS_ERROR_NOTFOUND;
 	}
-	// else if (SFS_IS_SYM_LINK(dentry->inode)) {   // 实验无需考虑软链接和硬链接的实现
-	// 	sfs_stat->st_mode = S_IFLNK | SFS_DEFAULT_PERM;
-	// 	sfs_stat->st_size = dentry->inode->size;
-	// }
 
-	nfs_stat->st_nlink = 1;
-	nfs_stat->st_uid 	 = getuid();
-	nfs_stat->st_gid 	 = getgid();
-	nfs_stat->st_atime   = time(NULL);
-	nfs_stat->st_mtime   = time(NULL);
-	nfs_stat->st_blksize = NFS_BLKS_SZ(1);
-	nfs_stat->st_blocks	= NFS_DATA_PER_FILE;
-
-	if (is_root) {
-		nfs_stat->st_size	= nfs_super.sz_usage; 
-		nfs_stat->st_blocks = NFS_DISK_SZ() / (NFS_IO_SZ() * 2);
-		nfs_stat->st_nlink  = 2;		/* !特殊，根目录link数为2 */
-	}
-	return NFS_ERROR_NONE;
+	ret = nfs_fill_stat(dentry, nfs_stat);
+	nfs_epoch_exit();
+	nfs_icache_balance();
+	return ret;
 	// return 0;
 }
 
@@ -176,28 +287,72 @@ int nfs_getattr(const char* path, struct stat * nfs_stat) {
  * off: 下一次offset从哪里开始，这里可以理解为第几个dentry
  * 
  * @param offset 第几个目录项？
- * @param fi 可忽略
+ * @param fi 文件信息，fi->fh为opendir时保存的句柄，记录了上次readdir结束时的游标
  * @return int 0成功，否则返回对应错误号
  */
 int nfs_readdir(const char * path, void * buf, fuse_fill_dir_t filler, off_t offset,
 			    		 struct fuse_file_info * fi) {
     /* TODO: 解析路径，获取目录的Inode，并读取目录项，利用filler填充到buf，可参考/fs/simplefs/sfs.c的sfs_readdir()函数实现 */
 	boolean	is_find, is_root;
-	int		cur_dir = offset;
+	struct nfs_fhandle* fh = NFS_FH(fi);
+	struct nfs_dentry*  dentry;
+	struct nfs_dentry*  sub_dentry;
+	struct nfs_inode*   inode;
+	struct stat         sub_stat;
+
+	// 优先使用opendir时保存的句柄，否则解析路径，获取目录的Inode
+	// 不加锁遍历目录项链表，没有句柄时目录本身也可能被inode缓存回收，都在epoch临界区内访问
+	nfs_epoch_enter();
+	if (fh != NULL) {
+		dentry = fh->dentry;
+		inode  = fh->inode;
+	}
+	else {
+		dentry = nfs_lookup(path, &is_find, &is_root);
+		if (!is_find) {
+			nfs_epoch_exit();
+			return dentry == NULL ? -NFS_ERROR_IO : -NFS_ERROR_NOTFOUND;
+		}
+		inode = nfs_dentry_inode(dentry);
+		if (inode == NULL) {   // 解析之后被淘汰，重新读入失败
+			nfs_epoch_exit();
+			return -NFS_ERROR_IO;
+		}
+	}
 
-	// 解析路径，获取目录的Inode
-	struct nfs_dentry* dentry = nfs_lookup(path, &is_find, &is_root);
-	struct nfs_dentry* sub_dentry;
-	struct sfs_inode* inode;
-	if (is_find) {
-		inode = dentry->inode;
-		sub_dentry = nfs_get_dentry(inode, cur_dir);   // 获取inode的第cur_dir(即offset)个目录项
-		if (sub_dentry) {
-			filler(buf, sub_dentry->name, NULL, ++offset);   // 填充至buf输出
+	// 从上次的游标处继续，游标失效时才从头定位第offset个目录项
+	// 并发创建的目录项追加在末尾，可能被本次读到也可能留给下一次
+	if (fh != NULL && fh->pos == offset) {
+		sub_dentry = fh->next;
+	}
+	else {
+		sub_dentry = nfs_get_dentry(inode, offset);
+	}
+
+	if (offset == 0 && fh == NULL) {   // 有句柄时opendir已提交预读，否则首次读取目录时子目录项的inode表块一并读入
+		nfs_prefetch_inodes(inode, FALSE);
+	}
+
+	// 一次尽可能多地填充目录项，filler返回非0说明buf已满
+	while (sub_dentry) {
+		if (nfs_fill_stat(sub_dentry, &sub_stat) != NFS_ERROR_NONE) {   // 子目录项的inode读入失败
+			nfs_epoch_exit();
+			return -NFS_ERROR_IO;
 		}
-		return NFS_ERROR_NONE;
+		if (filler(buf, sub_dentry->name, &sub_stat, offset + 1)) {
+			break;
+		}
+		offset++;
+		sub_dentry = NFS_LOAD(sub_dentry->brother);
+	}
+	nfs_epoch_exit();
+
+	if (fh != NULL) {
+		fh->pos  = offset;
+		fh->next = sub_dentry;
 	}
-	return -NFS_ERROR_NOTFOUND;
+	nfs_icache_balance();
+	return NFS_ERROR_NONE;
     // return 0;
 }
 
@@ -213,81 +368,157 @@ int nfs_mknod(const char* path, mode_t mode, dev_t dev) {
 	/* TODO: 解析路径，并创建相应的文件 */
 	boolean	is_find, is_root;
 	
-	// 解析路径，获取路径对应的目录项
-	struct nfs_dentry* last_dentry = nfs_lookup(path, &is_find, &is_root);
-	struct nfs_dentry* dentry;
-	struct nfs_inode* inode;
-	char* fname;
+	struct nfs_dentry* last_dentry;
+	int   ret;
 	
+	// 在解析路径和加inode锁之前进入，提交时看到的是完整的操作，期间inode缓存也不会回收找到的目录项
+	if (strlen(nfs_get_fname(path)) > MAX_NAME_LEN) {   // 文件名过长时不截断
+		return -NFS_ERROR_NAMETOOLONG;
+	}
+	nfs_journal_begin();
+	last_dentry = nfs_lookup(path, &is_find, &is_root);   // 解析路径，获取路径对应的目录项
+	if (last_dentry == NULL) {   // 路径上的inode读入失败
+		nfs_journal_end();
+		return -NFS_ERROR_IO;
+	}
 	if (is_find == TRUE) {
+		nfs_journal_end();
 		return -NFS_ERROR_EXISTS;
 	}
-
-	fname = nfs_get_fname(path);
-	
-	// 为文件创建目录项
-	if (S_ISREG(mode)) {
-		dentry = new_dentry(fname, NFS_REG_FILE);
-	}
-	else if (S_ISDIR(mode)) {
-		dentry = new_dentry(fname, NFS_DIR);
+	if (NFS_IS_REG(last_dentry->inode)) {
+		nfs_journal_end();
+		return -NFS_ERROR_NOTDIR;
 	}
-	else {
-		dentry = new_dentry(fname, NFS_REG_FILE);
+
+	// 为文件创建目录项和inode，并插入到父目录中
+	ret = nfs_create(last_dentry->inode, nfs_get_fname(path), S_ISDIR(mode) ? NFS_DIR : NFS_REG_FILE, NULL);
+	nfs_journal_end();
+	if (ret < 0) {
+		return ret;
 	}
-	dentry->parent = last_dentry;
-	inode = nfs_alloc_inode(dentry);   // 为目录项分配一个inode
-	// nfs_dump_map();
-	nfs_alloc_dentry(last_dentry->inode, dentry);   // 将dentry插入到父目录inode中
+	nfs_dcache_invalidate(path);   // 该路径的负缓存失效
+	nfs_flush_throttle();   // 脏数据过多时等待写回，此时已不持有任何inode锁
+	nfs_icache_balance();
 
 	return NFS_ERROR_NONE;
 	// return 0;
 }
 
 /**
- * @brief 修改时间，为了不让touch报错 
+ * @brief 修改访问时间和修改时间，inode修改时间同时更新为当前时间
  * 
  * @param path 相对于挂载点的路径
- * @param tv 实践
+ * @param tv tv[0]为访问时间，tv[1]为修改时间，可以为UTIME_NOW/UTIME_OMIT；tv为NULL表示都设为当前时间
  * @return int 0成功，否则返回对应错误号
  */
 int nfs_utimens(const char* path, const struct timespec tv[2]) {
-	(void)path;
-	return 0;
+	boolean	is_find, is_root;
+	struct nfs_dentry* dentry;
+	struct nfs_inode*  inode;
+
+	nfs_journal_begin();   // 在解析路径之前进入，期间找到的inode不会被inode缓存回收
+	dentry = nfs_lookup(path, &is_find, &is_root);
+	if (!is_find) {
+		nfs_journal_end();
+		return dentry == NULL ? -NFS_ERROR_IO : -NFS_ERROR_NOTFOUND;
+	}
+	inode = dentry->inode;
+	pthread_rwlock_wrlock(&inode->lock);
+	nfs_inode_utimens(inode, tv);
+	pthread_rwlock_unlock(&inode->lock);
+	nfs_journal_end();
+	nfs_flush_throttle();
+	nfs_icache_balance();
+	return NFS_ERROR_NONE;
 }
 /******************************************************************************
 * SECTION: 选做函数实现
 *******************************************************************************/
 /**
- * @brief 写入文件
+ * @brief 写入文件，直接拷贝到inode的数据块中，数据块按需分配并标记为脏，等待sync时写回
  * 
  * @param path 相对于挂载点的路径
  * @param buf 写入的内容
  * @param size 写入的字节数
  * @param offset 相对文件的偏移
- * @param fi 可忽略
+ * @param fi 文件信息，fi->fh为open时保存的句柄
  * @return int 写入大小
  */
 int nfs_write(const char* path, const char* buf, size_t size, off_t offset,
 		        struct fuse_file_info* fi) {
-	/* 选做 */
-	return size;
+	boolean	is_find, is_root;
+	struct nfs_inode*  inode;
+	struct nfs_dentry* dentry;
+	int 			   ret;
+
+	nfs_journal_begin();   // 在解析路径之前进入，期间找到的inode不会被inode缓存回收
+	if (NFS_FH(fi) != NULL) {
+		inode = NFS_FH(fi)->inode;
+	}
+	else {
+		dentry = nfs_lookup(path, &is_find, &is_root);
+		if (!is_find) {
+			nfs_journal_end();
+			return dentry == NULL ? -NFS_ERROR_IO : -NFS_ERROR_NOTFOUND;
+		}
+		inode = dentry->inode;
+	}
+	if (NFS_IS_DIR(inode)) {
+		nfs_journal_end();
+		return -NFS_ERROR_ISDIR;
+	}
+	pthread_rwlock_wrlock(&inode->lock);
+	ret = nfs_inode_write(inode, buf, size, offset);
+	pthread_rwlock_unlock(&inode->lock);
+	nfs_journal_end();
+	nfs_flush_throttle();
+	nfs_icache_balance();
+	return ret;
 }
 
 /**
- * @brief 读取文件
+ * @brief 读取文件，直接从inode的数据块拷贝到buf中
  * 
  * @param path 相对于挂载点的路径
  * @param buf 读取的内容
  * @param size 读取的字节数
  * @param offset 相对文件的偏移
- * @param fi 可忽略
+ * @param fi 文件信息，fi->fh为open时保存的句柄
  * @return int 读取大小
  */
 int nfs_read(const char* path, char* buf, size_t size, off_t offset,
 		       struct fuse_file_info* fi) {
-	/* 选做 */
-	return size;			   
+	boolean	is_find, is_root;
+	struct nfs_inode*  inode;
+	struct nfs_dentry* dentry;
+	int 			   ret;
+
+	nfs_epoch_enter();   // 没有句柄时inode可能被inode缓存回收，在临界区内访问
+	if (NFS_FH(fi) != NULL) {
+		inode = NFS_FH(fi)->inode;
+	}
+	else {
+		dentry = nfs_lookup(path, &is_find, &is_root);
+		if (!is_find) {
+			nfs_epoch_exit();
+			return dentry == NULL ? -NFS_ERROR_IO : -NFS_ERROR_NOTFOUND;
+		}
+		inode = nfs_dentry_inode(dentry);
+		if (inode == NULL) {   // 解析之后被淘汰，重新读入失败
+			nfs_epoch_exit();
+			return -NFS_ERROR_IO;
+		}
+	}
+	if (NFS_IS_DIR(inode)) {
+		nfs_epoch_exit();
+		return -NFS_ERROR_ISDIR;
+	}
+	pthread_rwlock_rdlock(&inode->lock);
+	ret = nfs_inode_read(inode, NFS_FH(fi), buf, size, offset);
+	pthread_rwlock_unlock(&inode->lock);
+	nfs_epoch_exit();
+	nfs_icache_balance();
+	return ret;			   
 }
 
 /**
@@ -331,28 +562,187 @@ int nfs_rename(const char* from, const char* to) {
 }
 
 /**
- * @brief 打开文件，可以在这里维护fi的信息，例如，fi->fh可以理解为一个64位指针，可以把自己想保存的数据结构
- * 保存在fh中
+ * @brief 打开文件，解析一次路径，将引用inode的句柄保存在fi->fh中，之后的读写无需再解析路径
  * 
  * @param path 相对于挂载点的路径
  * @param fi 文件信息
  * @return int 0成功，否则返回对应错误号
  */
 int nfs_open(const char* path, struct fuse_file_info* fi) {
-	/* 选做 */
-	return 0;
+	boolean	is_find, is_root;
+	struct nfs_fhandle* fh;
+	struct nfs_dentry*  dentry;
+	struct nfs_inode*   inode;
+
+	// 只在打开时解析一次路径，之后的读写直接通过句柄访问inode，句柄持有引用期间inode不会被淘汰
+	nfs_epoch_enter();
+	do {   // 解析之后、拿到引用之前inode被淘汰时重新解析
+		dentry = nfs_lookup(path, &is_find, &is_root);
+		if (!is_find) {
+			nfs_epoch_exit();
+			return dentry == NULL ? -NFS_ERROR_IO : -NFS_ERROR_NOTFOUND;
+		}
+		inode = nfs_dentry_inode(dentry);
+		if (inode == NULL) {   // 解析之后被淘汰，重新读入失败
+			nfs_epoch_exit();
+			return -NFS_ERROR_IO;
+		}
+		if (NFS_IS_DIR(inode)) {
+			nfs_epoch_exit();
+			return -NFS_ERROR_ISDIR;
+		}
+		fh = nfs_fhandle_get(dentry);
+	} while (fh == (struct nfs_fhandle*)-NFS_ERROR_AGAIN);
+	nfs_epoch_exit();
+	if (fh == NULL) {
+		return -NFS_ERROR_NOMEM;
+	}
+	fi->fh = (uint64_t)(uintptr_t)fh;
+	fi->keep_cache = 1;   // 文件只会经本文件系统修改，打开时不必丢弃内核页缓存
+	nfs_icache_balance();
+	return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 每次close时调用，不写回，只把此前后台写回的失败报告给close；持久化由fsync负责
+ * 
+ * @param path 相对于挂载点的路径
+ * @param fi 文件信息
+ * @return int 0成功，否则返回对应错误号
+ */
+int nfs_flush(const char* path, struct fuse_file_info* fi) {
+	(void)path;
+	return nfs_flush_check(NFS_FH(fi));
+}
+
+/**
+ * @brief 关闭文件，写回该文件并释放open时分配的句柄；release不阻塞close，写回失败由之后的flush或fsync报告
+ * 
+ * @param path 相对于挂载点的路径
+ * @param fi 文件信息
+ * @return int 0成功，否则返回对应错误号
+ */
+int nfs_release(const char* path, struct fuse_file_info* fi) {
+	if (NFS_FH(fi) != NULL && NFS_IS_REG(NFS_FH(fi)->inode)) {
+		nfs_journal_commit_inode(NFS_FH(fi)->inode);
+	}
+	nfs_fhandle_put(NFS_FH(fi));
+	fi->fh = 0;
+	return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 持久化文件: 只写回该文件的脏数据块，并把它的inode槽和占用的位图位写入日志
+ * 
+ * @param path 相对于挂载点的路径
+ * @param datasync 非0时只需持久化数据。inode中除大小和extent表(读出数据所必需)外只有时间戳，
+ *                 与它们在同一个inode槽中一起写入日志，因此不再区分
+ * @param fi 文件信息
+ * @return int 0成功，否则返回对应错误号
+ */
+int nfs_fsync(const char* path, int datasync, struct fuse_file_info* fi) {
+	boolean	is_find, is_root;
+	struct nfs_inode*  inode;
+	struct nfs_dentry* dentry;
+
+	int                ret;
+
+	(void)datasync;
+	nfs_epoch_enter();   // 没有句柄时inode可能被inode缓存回收(有脏数据的inode不会被回收)
+	if (fi != NULL && NFS_FH(fi) != NULL) {
+		inode = NFS_FH(fi)->inode;
+	}
+	else {
+		dentry = nfs_lookup(path, &is_find, &is_root);
+		if (!is_find) {
+			nfs_epoch_exit();
+			return dentry == NULL ? -NFS_ERROR_IO : -NFS_ERROR_NOTFOUND;
+		}
+		inode = nfs_dentry_inode(dentry);
+		if (inode == NULL) {   // 解析之后被淘汰，重新读入失败
+			nfs_epoch_exit();
+			return -NFS_ERROR_IO;
+		}
+	}
+	if (NFS_IS_DIR(inode)) {
+		nfs_epoch_exit();
+		return nfs_fsyncdir(path, datasync, fi);
+	}
+	ret = nfs_journal_commit_inode(inode);
+	nfs_epoch_exit();
+	if (fi != NULL && NFS_FH(fi) != NULL && nfs_flush_check(NFS_FH(fi)) < 0) {   // 本次提交或此前的后台写回失败
+		return -NFS_ERROR_IO;
+	}
+	return ret < 0 ? -NFS_ERROR_IO : NFS_ERROR_NONE;
 }
 
 /**
- * @brief 打开目录文件
+ * @brief 持久化目录: 目录项引用的新inode要一起写回，因此提交此前的所有操作，并发的请求合并为一次顺序写入
+ * 
+ * @param path 相对于挂载点的路径
+ * @param datasync 
+ * @param fi 文件信息
+ * @return int 0成功，否则返回对应错误号
+ */
+int nfs_fsyncdir(const char* path, int datasync, struct fuse_file_info* fi) {
+	(void)datasync;
+	return nfs_journal_commit(FALSE) < 0 ? -NFS_ERROR_IO : NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 打开目录文件，将引用inode的句柄保存在fi->fh中，句柄同时记录readdir的游标
  * 
  * @param path 相对于挂载点的路径
  * @param fi 文件信息
  * @return int 0成功，否则返回对应错误号
  */
 int nfs_opendir(const char* path, struct fuse_file_info* fi) {
-	/* 选做 */
-	return 0;
+	boolean	is_find, is_root;
+	struct nfs_fhandle* fh;
+	struct nfs_dentry*  dentry;
+	struct nfs_inode*   inode;
+
+	nfs_epoch_enter();
+	do {   // 解析之后、拿到引用之前inode被淘汰时重新解析
+		dentry = nfs_lookup(path, &is_find, &is_root);
+		if (!is_find) {
+			nfs_epoch_exit();
+			return dentry == NULL ? -NFS_ERROR_IO : -NFS_ERROR_NOTFOUND;
+		}
+		inode = nfs_dentry_inode(dentry);
+		if (inode == NULL) {   // 解析之后被淘汰，重新读入失败
+			nfs_epoch_exit();
+			return -NFS_ERROR_IO;
+		}
+		if (!NFS_IS_DIR(inode)) {
+			nfs_epoch_exit();
+			return -NFS_ERROR_NOTDIR;
+		}
+		fh = nfs_fhandle_get(dentry);
+	} while (fh == (struct nfs_fhandle*)-NFS_ERROR_AGAIN);
+	if (fh != NULL) {   // 子目录项的inode表块交给预读线程，与之后的readdir重叠
+		nfs_prefetch_inodes(fh->inode, TRUE);
+	}
+	nfs_epoch_exit();
+	if (fh == NULL) {
+		return -NFS_ERROR_NOMEM;
+	}
+	fi->fh = (uint64_t)(uintptr_t)fh;
+	nfs_icache_balance();
+	return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 关闭目录文件，释放opendir时分配的句柄
+ * 
+ * @param path 相对于挂载点的路径
+ * @param fi 文件信息
+ * @return int 0成功，否则返回对应错误号
+ */
+int nfs_releasedir(const char* path, struct fuse_file_info* fi) {
+	nfs_fhandle_put(NFS_FH(fi));
+	fi->fh = 0;
+	return NFS_ERROR_NONE;
 }
 
 /**
@@ -363,8 +753,27 @@ int nfs_opendir(const char* path, struct fuse_file_info* fi) {
  * @return int 0成功，否则返回对应错误号
  */
 int nfs_truncate(const char* path, off_t offset) {
-	/* 选做 */
-	return 0;
+	boolean	is_find, is_root;
+	int     ret;
+	struct nfs_dentry* dentry;
+
+	nfs_journal_begin();   // 在解析路径之前进入，期间找到的inode不会被inode缓存回收
+	dentry = nfs_lookup(path, &is_find, &is_root);
+	if (!is_find) {
+		nfs_journal_end();
+		return dentry == NULL ? -NFS_ERROR_IO : -NFS_ERROR_NOTFOUND;
+	}
+	if (NFS_IS_DIR(dentry->inode)) {
+		nfs_journal_end();
+		return -NFS_ERROR_ISDIR;
+	}
+	pthread_rwlock_wrlock(&dentry->inode->lock);
+	ret = nfs_inode_truncate(dentry->inode, offset);
+	pthread_rwlock_unlock(&dentry->inode->lock);
+	nfs_journal_end();
+	nfs_flush_throttle();
+	nfs_icache_balance();
+	return ret;
 }
 
 
@@ -393,11 +802,34 @@ int main(int argc, char **argv)
 	struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
 
 	nfs_options.device = strdup("/home/students/220110220/ddriver");
+	nfs_options.dcache_size = NFS_DCACHE_DEFAULT;
+	nfs_options.flush_interval = NFS_FLUSH_INTERVAL;
+	nfs_options.dirty_limit = NFS_DIRTY_LIMIT;
+	nfs_options.mem_limit = NFS_MEM_LIMIT;
+	nfs_options.cache_timeout = NFS_CACHE_TIMEOUT;
+	nfs_options.max_write = NFS_MAX_WRITE;
+	nfs_options.max_readahead = NFS_MAX_READAHEAD;
+	nfs_options.async_read = 1;
+	nfs_options.splice = 0;
+	nfs_options.writeback_cache = 0;
+	nfs_options.readahead = NFS_READAHEAD_MAX;
 
 	if (fuse_opt_parse(&args, &nfs_options, option_spec, NULL) == -1)
 		return -1;
+#ifdef NFS_HIGH_LEVEL
+	// 时间戳持久化之后内核缓存的属性不会过时，插在最前面，命令行中的-o attr_timeout等仍可覆盖
+	if (nfs_options.cache_timeout > 0) {
+		char timeout_opt[64];
+		snprintf(timeout_opt, sizeof(timeout_opt), "-oattr_timeout=%d,entry_timeout=%d",
+				 nfs_options.cache_timeout, nfs_options.cache_timeout);
+		if (fuse_opt_insert_arg(&args, 1, timeout_opt) == -1)
+			return -1;
+	}
 	
 	ret = fuse_main(args.argc, args.argv, &operations, NULL);
+#else
+	ret = nfs_ll_main(&args);   // 缓存有效期等由低层接口自行解析
+#endif
 	fuse_opt_free_args(&args);
 	return ret;
 }
\ No newline at end of file
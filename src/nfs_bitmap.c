@@ -0,0 +1,181 @@
+#include "../include/nfs.h"
+
+#define NFS_BM_BIT(bit)                 (1ULL << ((bit) % UINT64_BITS))
+#define NFS_BM_MIN(a, b)                ((a) < (b) ? (a) : (b))
+
+/**
+ * @brief 读取位图的第i个字，超出有效位的部分视为已占用
+ *
+ * @param bm
+ * @param i 字下标
+ * @return uint64_t
+ */
+static inline uint64_t nfs_bitmap_word(struct nfs_bitmap* bm, int i) {
+    int tail = bm->nbits - i * UINT64_BITS;   // 该字中有效位的数量
+    if (i >= bm->nwords) {
+        return ~0ULL;
+    }
+    if (tail < UINT64_BITS) {
+        return bm->words[i] | (~0ULL << tail);
+    }
+    return bm->words[i];
+}
+
+/**
+ * @brief 在[from, to)中查找第一段长度不小于n的连续空闲位
+ *
+ * @param bm
+ * @param from 起始位
+ * @param to 结束位(不含)
+ * @param n 需要的连续空闲位数
+ * @return int 起始位，找不到返回-1
+ */
+static int nfs_bitmap_find(struct nfs_bitmap* bm, int from, int to, int n) {
+    int      bit = from, start, end, i;
+    uint64_t w;
+
+    while (bit < to) {
+        /* 找到下一个空闲位，bit之前的位视为已占用 */
+        i = bit / UINT64_BITS;
+        w = nfs_bitmap_word(bm, i) | (NFS_BM_BIT(bit) - 1);
+        if (~w == 0) {
+            bit = (i + 1) * UINT64_BITS;
+            continue;
+        }
+        start = i * UINT64_BITS + __builtin_ctzll(~w);
+        if (start >= to) {
+            break;
+        }
+        if (n == 1) {
+            return start;
+        }
+
+        /* 统计从start开始的连续空闲位数 */
+        end = start;
+        while (end - start < n && end < bm->nbits) {
+            w = nfs_bitmap_word(bm, end / UINT64_BITS) >> (end % UINT64_BITS);
+            if (w == 0) {   // 该字剩余部分全部空闲
+                end = (end / UINT64_BITS + 1) * UINT64_BITS;
+                continue;
+            }
+            end += __builtin_ctzll(w);
+            break;
+        }
+        if (end - start >= n && start + n <= bm->nbits) {
+            return start;
+        }
+        bit = end;
+    }
+    return -1;
+}
+
+/**
+ * @brief 初始化位图分配器
+ *
+ * @param bm
+ * @param map 位图内存，大小需为8字节的整数倍
+ * @param nbits 有效位数
+ */
+void nfs_bitmap_init(struct nfs_bitmap* bm, uint8_t* map, int nbits) {
+    bm->words  = (uint64_t*)map;
+    bm->nbits  = nbits;
+    bm->nwords = NFS_ROUND_UP(nbits, UINT64_BITS) / UINT64_BITS;
+    bm->cursor = 0;
+    bm->free   = 0;
+    bm->dirty  = FALSE;
+    bm->freed  = FALSE;
+    for (int i = 0; i < bm->nwords; i++) {
+        bm->free += __builtin_popcountll(~nfs_bitmap_word(bm, i));
+    }
+}
+
+/**
+ * @brief 分配n个连续的空闲位，从next-fit游标开始查找，到末尾后回绕
+ *
+ * @param bm
+ * @param n 连续位数
+ * @return int 起始位，没有空间返回-NFS_ERROR_NOSPACE
+ */
+int nfs_bitmap_alloc_range(struct nfs_bitmap* bm, int n) {
+    int start;
+
+    if (n <= 0 || bm->free < n) {
+        return -NFS_ERROR_NOSPACE;
+    }
+    start = nfs_bitmap_find(bm, bm->cursor, bm->nbits, n);
+    if (start < 0) {   // 回绕到开头继续查找
+        start = nfs_bitmap_find(bm, 0, bm->cursor, n);
+    }
+    if (start < 0) {
+        return -NFS_ERROR_NOSPACE;
+    }
+
+    nfs_bitmap_set(bm, start, n);
+    bm->cursor = (start + n) % bm->nbits;
+    return start;
+}
+
+/**
+ * @brief 分配一个空闲位
+ *
+ * @param bm
+ * @return int 分配的位，没有空间返回-NFS_ERROR_NOSPACE
+ */
+int nfs_bitmap_alloc(struct nfs_bitmap* bm) {
+    return nfs_bitmap_alloc_range(bm, 1);
+}
+
+/**
+ * @brief 将[start, start + n)置为已占用，调用者需保证这些位原本空闲
+ *
+ * @param bm
+ * @param start
+ * @param n
+ */
+void nfs_bitmap_set(struct nfs_bitmap* bm, int start, int n) {
+    int      bit = start, len;
+    uint64_t mask;
+    while (bit < start + n) {
+        len  = NFS_BM_MIN(UINT64_BITS - bit % UINT64_BITS, start + n - bit);
+        mask = (len == UINT64_BITS) ? ~0ULL : ((1ULL << len) - 1) << (bit % UINT64_BITS);
+        bm->words[bit / UINT64_BITS] |= mask;
+        bit += len;
+    }
+    bm->free -= n;
+    bm->dirty = TRUE;
+}
+
+/**
+ * @brief 释放[start, start + n)
+ *
+ * @param bm
+ * @param start
+ * @param n
+ */
+void nfs_bitmap_free(struct nfs_bitmap* bm, int start, int n) {
+    int      bit = start, len;
+    uint64_t mask;
+    while (bit < start + n) {
+        len  = NFS_BM_MIN(UINT64_BITS - bit % UINT64_BITS, start + n - bit);
+        mask = (len == UINT64_BITS) ? ~0ULL : ((1ULL << len) - 1) << (bit % UINT64_BITS);
+        bm->free += __builtin_popcountll(bm->words[bit / UINT64_BITS] & mask);
+        bm->words[bit / UINT64_BITS] &= ~mask;
+        bit += len;
+    }
+    bm->dirty = TRUE;
+    bm->freed = TRUE;
+}
+
+/**
+ * @brief 判断某一位是否已占用
+ *
+ * @param bm
+ * @param bit
+ * @return boolean
+ */
+boolean nfs_bitmap_test(struct nfs_bitmap* bm, int bit) {
+    if (bit < 0 || bit >= bm->nbits) {
+        return TRUE;
+    }
+    return (bm->words[bit / UINT64_BITS] & NFS_BM_BIT(bit)) != 0;
+}
@@ -0,0 +1,494 @@
+#include "../include/nfs.h"
+
+extern struct nfs_super      nfs_super;
+
+#define NFS_BCACHE()                    (&nfs_super.bcache)
+#define NFS_BUF_HASH(blk)               ((unsigned int)(blk) % NFS_BUF_HASH_SZ)
+#define NFS_BUF_WRITABLE(buf)           (((buf)->flags & (NFS_FLAG_BUF_DIRTY | NFS_FLAG_BUF_META)) == NFS_FLAG_BUF_DIRTY)
+
+/**
+ * @brief 从设备读出一个逻辑块(一个逻辑块为2个IO单位)
+ *
+ * @param blk 逻辑块号
+ * @param out_content 存放读出的内容，大小为NFS_BLKS_SZ(1)
+ * @return int
+ */
+static int nfs_dev_read_blk(int blk, uint8_t* out_content) {
+    uint8_t* cur = out_content;
+    int      size = NFS_BLKS_SZ(1);
+    if (ddriver_seek(NFS_DRIVER(), NFS_BLKS_SZ(blk), SEEK_SET) < 0) {
+        return -NFS_ERROR_SEEK;
+    }
+    while (size != 0) {
+        if (ddriver_read(NFS_DRIVER(), (char*)cur, NFS_IO_SZ()) < 0) {
+            return -NFS_ERROR_IO;
+        }
+        cur  += NFS_IO_SZ();
+        size -= NFS_IO_SZ();
+    }
+    NFS_BCACHE()->dev_read++;
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 将块号连续的一段缓冲区写入设备: 只寻道一次，之后按IO单位顺序写出
+ *
+ * @param run 缓冲区，块号从run[0]->blk开始依次加1
+ * @param n 缓冲区数量
+ * @return int
+ */
+static int nfs_dev_write_run(struct nfs_buf** run, int n) {
+    if (ddriver_seek(NFS_DRIVER(), NFS_BLKS_SZ(run[0]->blk), SEEK_SET) < 0) {
+        return -NFS_ERROR_SEEK;
+    }
+    NFS_BCACHE()->dev_seek++;
+    for (int i = 0; i < n; i++) {
+        for (int k = 0; k < NFS_BLKS_SZ(1); k += NFS_IO_SZ()) {
+            if (ddriver_write(NFS_DRIVER(), (char*)run[i]->data + k, NFS_IO_SZ()) < 0) {
+                return -NFS_ERROR_IO;
+            }
+        }
+        NFS_BCACHE()->dev_write++;
+    }
+    return NFS_ERROR_NONE;
+}
+
+// 将buf从LRU链表中摘下
+static inline void nfs_lru_del(struct nfs_buf* buf) {
+    buf->prev->next = buf->next;
+    buf->next->prev = buf->prev;
+}
+
+// 将buf放到LRU链表最近使用端
+static inline void nfs_lru_add(struct nfs_buf* buf) {
+    struct nfs_buf* head = &NFS_BCACHE()->lru;
+    buf->next        = head->next;
+    buf->prev        = head;
+    head->next->prev = buf;
+    head->next       = buf;
+}
+
+// 将buf从哈希链表中摘下
+static void nfs_hash_del(struct nfs_buf* buf) {
+    struct nfs_buf** pp = &NFS_BCACHE()->hash[NFS_BUF_HASH(buf->blk)];
+    while (*pp != NULL) {
+        if (*pp == buf) {
+            *pp = buf->hnext;
+            break;
+        }
+        pp = &(*pp)->hnext;
+    }
+    buf->hnext = NULL;
+}
+
+/**
+ * @brief 初始化块缓存，需在获取设备IO大小之后调用
+ *
+ * @param nbufs 缓冲区数量
+ * @return int
+ */
+int nfs_bcache_init(int nbufs) {
+    struct nfs_bcache*  bcache = NFS_BCACHE();
+    pthread_mutexattr_t attr;
+    memset(bcache, 0, sizeof(struct nfs_bcache));
+    bcache->bufs  = (struct nfs_buf*)calloc(nbufs, sizeof(struct nfs_buf));
+    bcache->data  = (uint8_t*)malloc(NFS_BLKS_SZ(nbufs));
+    bcache->queue = (struct nfs_buf**)malloc(nbufs * sizeof(struct nfs_buf*));
+    if (bcache->bufs == NULL || bcache->data == NULL || bcache->queue == NULL) {
+        free(bcache->bufs);
+        free(bcache->data);
+        free(bcache->queue);
+        return -NFS_ERROR_NOSPACE;
+    }
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);   // nfs_driver_read等在持锁时还会调用nfs_bread
+    pthread_mutex_init(&bcache->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    bcache->nbufs    = nbufs;
+    bcache->lru.next = &bcache->lru;
+    bcache->lru.prev = &bcache->lru;
+    for (int i = 0; i < nbufs; i++) {
+        bcache->bufs[i].blk  = -1;
+        bcache->bufs[i].data = bcache->data + NFS_BLKS_SZ(i);
+        nfs_lru_add(&bcache->bufs[i]);   // 空闲缓冲区同样挂在LRU链表上，优先被使用
+    }
+    return NFS_ERROR_NONE;
+}
+
+// 查找已缓存的逻辑块
+static struct nfs_buf* nfs_bcache_find(int blk) {
+    struct nfs_buf* buf = NFS_BCACHE()->hash[NFS_BUF_HASH(blk)];
+    while (buf != NULL && buf->blk != blk) {
+        buf = buf->hnext;
+    }
+    return buf;
+}
+
+/**
+ * @brief 写回将被淘汰的脏块，块号相邻的脏块(未提交的元数据块除外)一并写回，只寻道一次
+ * 相邻的块写回后仍留在块缓存中，之后淘汰时不必再写
+ *
+ * @param buf 将被淘汰的脏块
+ * @return int
+ */
+static int nfs_bcache_write_cluster(struct nfs_buf* buf) {
+    struct nfs_buf* run[NFS_WRITE_CLUSTER];
+    struct nfs_buf* nb;
+    int             first = buf->blk;
+    int             n = 0;
+
+    while (first > 0 && buf->blk - first < NFS_WRITE_CLUSTER / 2
+           && (nb = nfs_bcache_find(first - 1)) != NULL && NFS_BUF_WRITABLE(nb)) {
+        first--;
+    }
+    while (n < NFS_WRITE_CLUSTER && (nb = nfs_bcache_find(first + n)) != NULL && NFS_BUF_WRITABLE(nb)) {
+        run[n++] = nb;
+    }
+    if (nfs_dev_write_run(run, n) != NFS_ERROR_NONE) {
+        return -NFS_ERROR_IO;
+    }
+    for (int i = 0; i < n; i++) {
+        run[i]->flags &= ~(NFS_FLAG_BUF_DIRTY | NFS_FLAG_BUF_LOGGED);
+    }
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 淘汰最久未使用的缓冲区(脏块先写回)，并将其移到最近使用端
+ * 未写入日志的元数据块不能写回原位置，跳过
+ *
+ * @return struct nfs_buf* 空闲的缓冲区，写回失败返回NULL
+ */
+static struct nfs_buf* nfs_bcache_evict() {
+    struct nfs_buf* buf = NFS_BCACHE()->lru.prev;
+
+    while (buf->flags & NFS_FLAG_BUF_META) {   // meta_cnt小于缓冲区数量，一定能找到
+        buf = buf->prev;
+    }
+    if (buf->flags & NFS_FLAG_BUF_DIRTY) {
+        if (nfs_bcache_write_cluster(buf) != NFS_ERROR_NONE) {
+            NFS_DBG("[%s] write back blk %d error\n", __func__, buf->blk);
+            return NULL;
+        }
+    }
+    if (buf->flags & NFS_FLAG_BUF_OCCUPY) {
+        nfs_hash_del(buf);
+    }
+    buf->flags = 0;
+    buf->blk   = -1;
+    nfs_lru_del(buf);
+    nfs_lru_add(buf);
+    return buf;
+}
+
+// 将buf登记为逻辑块blk的缓冲区
+static void nfs_bcache_insert(struct nfs_buf* buf, int blk) {
+    buf->blk   = blk;
+    buf->flags = NFS_FLAG_BUF_OCCUPY;
+    buf->hnext = NFS_BCACHE()->hash[NFS_BUF_HASH(blk)];
+    NFS_BCACHE()->hash[NFS_BUF_HASH(blk)] = buf;
+}
+
+/**
+ * @brief 查找逻辑块对应的缓冲区，找不到则淘汰最久未使用的缓冲区(脏块先写回)
+ *
+ * @param blk 逻辑块号
+ * @param is_read 未命中时是否需要从设备读出块内容
+ * @return struct nfs_buf* 失败返回NULL
+ */
+static struct nfs_buf* nfs_bcache_get(int blk, boolean is_read) {
+    struct nfs_bcache* bcache = NFS_BCACHE();
+    struct nfs_buf*    buf    = nfs_bcache_find(blk);
+
+    if (buf != NULL) {   // 命中，移动到最近使用端
+        bcache->hit++;
+        nfs_lru_del(buf);
+        nfs_lru_add(buf);
+        return buf;
+    }
+
+    bcache->miss++;
+    buf = nfs_bcache_evict();   // 淘汰最久未使用的缓冲区
+    if (buf == NULL) {
+        return NULL;
+    }
+    if (is_read && nfs_dev_read_blk(blk, buf->data) != NFS_ERROR_NONE) {
+        NFS_DBG("[%s] read blk %d error\n", __func__, blk);
+        return NULL;
+    }
+    nfs_bcache_insert(buf, blk);
+    return buf;
+}
+
+/**
+ * @brief 将[blk, blk + n)预读进块缓存，每段连续未缓存的逻辑块只寻道一次后顺序读出
+ *
+ * @param blk 起始逻辑块号
+ * @param n 逻辑块数量，不能超过缓冲区数量
+ * @return int
+ */
+int nfs_bcache_prefetch(int blk, int n) {
+    struct nfs_bcache* bcache = NFS_BCACHE();
+    struct nfs_buf**   run;
+    int                start, len, ret = NFS_ERROR_NONE;
+
+    if (n <= 0 || n > bcache->nbufs) {
+        return -NFS_ERROR_INVAL;
+    }
+    run = (struct nfs_buf**)malloc(n * sizeof(struct nfs_buf*));
+    if (run == NULL) {
+        return -NFS_ERROR_NOMEM;
+    }
+    pthread_mutex_lock(&bcache->lock);
+    for (int i = 0; i < n && ret == NFS_ERROR_NONE; i = start + len) {
+        start = i;
+        while (start < n && nfs_bcache_find(blk + start) != NULL) {
+            start++;
+        }
+        /* 先腾出整段所需的缓冲区，避免写回脏块打断顺序读 */
+        for (len = 0; start + len < n && nfs_bcache_find(blk + start + len) == NULL; len++) {
+            run[len] = nfs_bcache_evict();
+            if (run[len] == NULL) {
+                ret = -NFS_ERROR_IO;
+                break;
+            }
+        }
+        if (len == 0 || ret != NFS_ERROR_NONE) {
+            continue;
+        }
+        if (ddriver_seek(NFS_DRIVER(), NFS_BLKS_SZ(blk + start), SEEK_SET) < 0) {
+            ret = -NFS_ERROR_SEEK;
+            break;
+        }
+        for (int j = 0; j < len; j++) {
+            for (int k = 0; k < NFS_BLKS_SZ(1); k += NFS_IO_SZ()) {
+                if (ddriver_read(NFS_DRIVER(), (char*)run[j]->data + k, NFS_IO_SZ()) < 0) {
+                    ret = -NFS_ERROR_IO;
+                    break;
+                }
+            }
+            if (ret != NFS_ERROR_NONE) {
+                break;
+            }
+            nfs_bcache_insert(run[j], blk + start + j);
+            bcache->dev_read++;
+        }
+    }
+    pthread_mutex_unlock(&bcache->lock);
+    free(run);
+    return ret;
+}
+
+/**
+ * @brief 读取逻辑块，返回内容有效的缓冲区
+ *
+ * @param blk 逻辑块号
+ * @return struct nfs_buf*
+ */
+struct nfs_buf* nfs_bread(int blk) {
+    struct nfs_buf* buf;
+    pthread_mutex_lock(&NFS_BCACHE()->lock);
+    buf = nfs_bcache_get(blk, TRUE);
+    pthread_mutex_unlock(&NFS_BCACHE()->lock);
+    return buf;
+}
+
+/**
+ * @brief 获取逻辑块的缓冲区但不读设备，用于整块覆盖写
+ *
+ * @param blk 逻辑块号
+ * @return struct nfs_buf*
+ */
+struct nfs_buf* nfs_bget(int blk) {
+    struct nfs_buf* buf;
+    pthread_mutex_lock(&NFS_BCACHE()->lock);
+    buf = nfs_bcache_get(blk, FALSE);
+    pthread_mutex_unlock(&NFS_BCACHE()->lock);
+    return buf;
+}
+
+/**
+ * @brief 标记缓冲区为脏，等待sync或淘汰时写回，调用者需持有块缓存锁
+ *
+ * @param buf
+ */
+void nfs_bdirty(struct nfs_buf* buf) {
+    buf->flags |= NFS_FLAG_BUF_DIRTY;
+}
+
+/**
+ * @brief 将已缓存的逻辑块标记为未提交的元数据，提交写入日志之前不会被写回原位置，调用者需持有块缓存锁
+ *
+ * @param blk 逻辑块号
+ * @return int 未提交的元数据块已达上限(一个事务放不下)时不标记，返回-NFS_ERROR_NOSPACE
+ */
+int nfs_bmeta(int blk) {
+    struct nfs_bcache* bcache = NFS_BCACHE();
+    struct nfs_buf*    buf    = nfs_bcache_find(blk);
+
+    if (buf == NULL || (buf->flags & NFS_FLAG_BUF_META)) {
+        return NFS_ERROR_NONE;
+    }
+    if (bcache->meta_cnt >= bcache->meta_max) {
+        return -NFS_ERROR_NOSPACE;
+    }
+    buf->flags = (buf->flags & ~NFS_FLAG_BUF_LOGGED) | NFS_FLAG_BUF_META | NFS_FLAG_BUF_DIRTY;
+    bcache->meta_cnt++;
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 设置未提交元数据块数的上限
+ *
+ * @param n 上限，必须小于缓冲区数量
+ */
+void nfs_bcache_meta_max(int n) {
+    NFS_BCACHE()->meta_max = n < NFS_BCACHE()->nbufs ? n : NFS_BCACHE()->nbufs - 1;
+}
+
+/**
+ * @brief 收集所有未提交的元数据块，调用者需持有块缓存锁
+ *
+ * @param bufs 存放结果
+ * @param max bufs的容量
+ * @return int 元数据块数
+ */
+int nfs_bcache_meta(struct nfs_buf** bufs, int max) {
+    struct nfs_bcache* bcache = NFS_BCACHE();
+    int                n      = 0;
+
+    for (int i = 0; i < bcache->nbufs && n < max; i++) {
+        if (bcache->bufs[i].flags & NFS_FLAG_BUF_META) {
+            bufs[n++] = &bcache->bufs[i];
+        }
+    }
+    return n;
+}
+
+/**
+ * @brief 元数据块已写入日志，之后可以写回原位置，调用者需持有块缓存锁
+ *
+ * @param bufs
+ * @param n
+ */
+void nfs_bcache_logged(struct nfs_buf** bufs, int n) {
+    for (int i = 0; i < n; i++) {
+        bufs[i]->flags = (bufs[i]->flags & ~NFS_FLAG_BUF_META) | NFS_FLAG_BUF_LOGGED;
+    }
+    NFS_BCACHE()->meta_cnt -= n;
+}
+
+/**
+ * @brief 锁住块缓存。nfs_bread/nfs_bget返回的缓冲区只在持锁期间有效，
+ * 需要读写缓冲区内容的调用者应先加锁，用完后再解锁
+ */
+void nfs_bcache_lock() {
+    pthread_mutex_lock(&NFS_BCACHE()->lock);
+}
+
+/**
+ * @brief 解锁块缓存
+ */
+void nfs_bcache_unlock() {
+    pthread_mutex_unlock(&NFS_BCACHE()->lock);
+}
+
+// 按块号升序比较两个缓冲区
+static int nfs_buf_cmp(const void* a, const void* b) {
+    return (*(struct nfs_buf* const*)a)->blk - (*(struct nfs_buf* const*)b)->blk;
+}
+
+/**
+ * @brief 将块缓存中flags不含skip的脏块写回设备
+ * 脏块按块号(即设备偏移)排序后，块号连续的一段只寻道一次再顺序写出
+ *
+ * @param skip
+ * @return int 写回的逻辑块数，失败返回错误码
+ */
+static int nfs_bcache_sync_flags(int skip) {
+    struct nfs_bcache*   bcache = NFS_BCACHE();
+    struct nfs_buf**     queue  = bcache->queue;
+    struct nfs_buf*      buf;
+    int                  ret = NFS_ERROR_NONE;
+    int                  n = 0, cnt = 0, len;
+
+    pthread_mutex_lock(&bcache->lock);
+    for (int i = 0; i < bcache->nbufs; i++) {
+        buf = &bcache->bufs[i];
+        if ((buf->flags & NFS_FLAG_BUF_OCCUPY) && (buf->flags & NFS_FLAG_BUF_DIRTY)
+            && !(buf->flags & skip)) {
+            queue[n++] = buf;
+        }
+    }
+    if (n == 0) {
+        pthread_mutex_unlock(&bcache->lock);
+        return 0;
+    }
+    qsort(queue, n, sizeof(struct nfs_buf*), nfs_buf_cmp);
+
+    bcache->syncs++;
+    for (int i = 0; i < n; i += len) {
+        for (len = 1; i + len < n && queue[i + len]->blk == queue[i]->blk + len; len++) {
+            ;
+        }
+        if (nfs_dev_write_run(queue + i, len) != NFS_ERROR_NONE) {
+            NFS_DBG("[%s] write back blk %d-%d error\n", __func__, queue[i]->blk, queue[i]->blk + len - 1);
+            ret = -NFS_ERROR_IO;
+            continue;
+        }
+        for (int j = 0; j < len; j++) {
+            queue[i + j]->flags &= ~(NFS_FLAG_BUF_DIRTY | NFS_FLAG_BUF_LOGGED);
+        }
+        cnt += len;
+        bcache->sync_runs++;
+    }
+    bcache->sync_blks += cnt;
+    pthread_mutex_unlock(&bcache->lock);
+    return ret != NFS_ERROR_NONE ? ret : cnt;
+}
+
+/**
+ * @brief 将块缓存中所有脏块写回设备，未写入日志的元数据块除外
+ *
+ * @return int 写回的逻辑块数，失败返回错误码
+ */
+int nfs_bcache_sync() {
+    return nfs_bcache_sync_flags(NFS_FLAG_BUF_META);
+}
+
+/**
+ * @brief 只写回不属于日志的脏块(文件数据)
+ *
+ * @return int 写回的逻辑块数，失败返回错误码
+ */
+int nfs_bcache_sync_data() {
+    return nfs_bcache_sync_flags(NFS_FLAG_BUF_META | NFS_FLAG_BUF_LOGGED);
+}
+
+/**
+ * @brief 写回所有脏块并释放块缓存
+ *
+ * @return int
+ */
+int nfs_bcache_destroy() {
+    struct nfs_bcache*   bcache = NFS_BCACHE();
+    int                  ret    = nfs_bcache_sync() < 0 ? -NFS_ERROR_IO : NFS_ERROR_NONE;
+    struct ddriver_state state;
+
+    ddriver_ioctl(NFS_DRIVER(), IOC_REQ_DEVICE_STATE, &state);
+    NFS_DBG("[%s] hit: %d, miss: %d, dev read: %d blks, dev write: %d blks in %d seeks\n", __func__,
+            bcache->hit, bcache->miss, bcache->dev_read, bcache->dev_write, bcache->dev_seek);
+    NFS_DBG("[%s] sync: %d times, %d blks in %d runs\n", __func__,
+            bcache->syncs, bcache->sync_blks, bcache->sync_runs);
+    NFS_DBG("[%s] device read: %d, write: %d, seek: %d\n", __func__,
+            state.read_cnt, state.write_cnt, state.seek_cnt);
+    free(bcache->bufs);
+    free(bcache->data);
+    free(bcache->queue);
+    pthread_mutex_destroy(&bcache->lock);
+    bcache->bufs  = NULL;
+    bcache->data  = NULL;
+    bcache->queue = NULL;
+    bcache->nbufs = 0;
+    return ret;
+}
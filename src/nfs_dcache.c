@@ -0,0 +1,221 @@
+#include "../include/nfs.h"
+
+extern struct nfs_super      nfs_super;
+
+#define NFS_DCACHE()                    (&nfs_super.dcache)
+#define NFS_DCACHE_HASH(hash)           ((hash) % NFS_DCACHE_HASH_SZ)
+
+// 将条目从LRU链表中摘下
+static inline void nfs_dcache_lru_del(struct nfs_dcache_entry* entry) {
+    entry->prev->next = entry->next;
+    entry->next->prev = entry->prev;
+}
+
+// 将条目放到LRU链表最近使用端
+static inline void nfs_dcache_lru_add(struct nfs_dcache_entry* entry) {
+    struct nfs_dcache_entry* head = &NFS_DCACHE()->lru;
+    entry->next       = head->next;
+    entry->prev       = head;
+    head->next->prev  = entry;
+    head->next        = entry;
+}
+
+// 释放一个条目，由epoch回收调用
+static void nfs_dcache_entry_free(void* ptr) {
+    struct nfs_dcache_entry* entry = (struct nfs_dcache_entry*)ptr;
+    free(entry->path);
+    free(entry);
+}
+
+// 删除一个条目，条目可能正被无锁查询的线程访问，交给epoch回收
+static void nfs_dcache_del(struct nfs_dcache_entry* entry) {
+    struct nfs_dcache_entry** pp = &NFS_DCACHE()->hash[NFS_DCACHE_HASH(entry->hash)];
+    while (*pp != NULL) {
+        if (*pp == entry) {
+            NFS_STORE(*pp, entry->hnext);
+            break;
+        }
+        pp = &(*pp)->hnext;
+    }
+    nfs_dcache_lru_del(entry);
+    NFS_DCACHE()->cnt--;
+    nfs_epoch_retire(entry, nfs_dcache_entry_free);
+}
+
+// 查找路径对应的条目，调用者需持有dcache->lock或处于epoch临界区内
+static struct nfs_dcache_entry* nfs_dcache_find(const char* path, uint32_t hash) {
+    struct nfs_dcache_entry* entry = NFS_LOAD(NFS_DCACHE()->hash[NFS_DCACHE_HASH(hash)]);
+    while (entry != NULL) {
+        if (entry->hash == hash && strcmp(entry->path, path) == 0) {
+            return entry;
+        }
+        entry = NFS_LOAD(entry->hnext);
+    }
+    return NULL;
+}
+
+// 按CLOCK策略选出淘汰的条目: 从最久未使用端开始，被查询过的条目清除标记后移到最近使用端
+static struct nfs_dcache_entry* nfs_dcache_victim() {
+    struct nfs_dcache_entry* entry = NFS_DCACHE()->lru.prev;
+    while (__atomic_exchange_n(&entry->referenced, 0, __ATOMIC_RELAXED)) {
+        nfs_dcache_lru_del(entry);
+        nfs_dcache_lru_add(entry);
+        entry = NFS_DCACHE()->lru.prev;
+    }
+    return entry;
+}
+
+/**
+ * @brief 初始化路径缓存
+ *
+ * @param max 最大条目数，0表示关闭路径缓存
+ */
+void nfs_dcache_init(int max) {
+    struct nfs_dcache* dcache = NFS_DCACHE();
+    memset(dcache, 0, sizeof(struct nfs_dcache));
+    dcache->max      = max;
+    dcache->lru.next = &dcache->lru;
+    dcache->lru.prev = &dcache->lru;
+    pthread_mutex_init(&dcache->lock, NULL);
+}
+
+/**
+ * @brief 查询路径缓存，不加锁，只标记条目被访问过而不移动LRU链表
+ *
+ * @param path 完整路径
+ * @param dentry 命中时返回目录项，负缓存命中时返回NULL
+ * @return boolean 是否命中(包括负缓存)
+ */
+boolean nfs_dcache_lookup(const char* path, struct nfs_dentry** dentry) {
+    struct nfs_dcache*       dcache = NFS_DCACHE();
+    struct nfs_dcache_entry* entry;
+    uint32_t                 hash   = nfs_name_hash(path);
+
+    nfs_epoch_enter();
+    entry = nfs_dcache_find(path, hash);
+    if (entry == NULL) {
+        nfs_epoch_exit();
+        __atomic_add_fetch(&dcache->miss, 1, __ATOMIC_RELAXED);
+        return FALSE;
+    }
+    if (!__atomic_load_n(&entry->referenced, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&entry->referenced, 1, __ATOMIC_RELAXED);
+    }
+    *dentry = NFS_LOAD(entry->dentry);
+    nfs_epoch_exit();
+    __atomic_add_fetch(*dentry == NULL ? &dcache->neg_hit : &dcache->hit, 1, __ATOMIC_RELAXED);
+    return TRUE;
+}
+
+/**
+ * @brief 获取路径缓存的失效计数，在解析路径之前调用，作为nfs_dcache_add的参数
+ *
+ * @return uint32_t
+ */
+uint32_t nfs_dcache_gen() {
+    return NFS_LOAD(NFS_DCACHE()->gen);
+}
+
+/**
+ * @brief 加入路径缓存，容量不足时淘汰最久未使用的条目
+ * 解析路径期间有其他线程创建了文件或目录时，解析结果可能已经过时，不加入缓存
+ *
+ * @param path 完整路径
+ * @param dentry 路径对应的目录项，NULL表示路径不存在
+ * @param gen 解析路径之前nfs_dcache_gen的返回值
+ */
+void nfs_dcache_add(const char* path, struct nfs_dentry* dentry, uint32_t gen) {
+    struct nfs_dcache*       dcache = NFS_DCACHE();
+    uint32_t                 hash   = nfs_name_hash(path);
+    struct nfs_dcache_entry* entry;
+
+    if (dcache->max <= 0) {
+        return;
+    }
+    pthread_mutex_lock(&dcache->lock);
+    if (dcache->gen != gen) {
+        pthread_mutex_unlock(&dcache->lock);
+        return;
+    }
+    entry = nfs_dcache_find(path, hash);
+    if (entry != NULL) {
+        NFS_STORE(entry->dentry, dentry);
+        pthread_mutex_unlock(&dcache->lock);
+        return;
+    }
+    if (dcache->cnt >= dcache->max) {
+        nfs_dcache_del(nfs_dcache_victim());
+        dcache->evict++;
+    }
+
+    entry = (struct nfs_dcache_entry*)malloc(sizeof(struct nfs_dcache_entry));
+    entry->path       = strdup(path);
+    entry->hash       = hash;
+    entry->dentry     = dentry;
+    entry->referenced = 0;
+    entry->hnext      = dcache->hash[NFS_DCACHE_HASH(hash)];
+    NFS_STORE(dcache->hash[NFS_DCACHE_HASH(hash)], entry);   // 条目填好后再发布给无锁的查询
+    nfs_dcache_lru_add(entry);
+    dcache->cnt++;
+    pthread_mutex_unlock(&dcache->lock);
+}
+
+/**
+ * @brief 使某一路径的缓存失效，用于创建文件或目录
+ *
+ * @param path 完整路径
+ */
+void nfs_dcache_invalidate(const char* path) {
+    struct nfs_dcache_entry* entry;
+    uint32_t                 hash = nfs_name_hash(path);
+
+    pthread_mutex_lock(&NFS_DCACHE()->lock);
+    NFS_STORE(NFS_DCACHE()->gen, NFS_DCACHE()->gen + 1);
+    entry = nfs_dcache_find(path, hash);
+    if (entry != NULL) {
+        nfs_dcache_del(entry);
+        NFS_DCACHE()->invalidate++;
+    }
+    pthread_mutex_unlock(&NFS_DCACHE()->lock);
+}
+
+/**
+ * @brief 使某一路径及其下所有路径的缓存失效，用于删除和重命名
+ *
+ * @param path 完整路径
+ */
+void nfs_dcache_invalidate_prefix(const char* path) {
+    struct nfs_dcache*       dcache = NFS_DCACHE();
+    struct nfs_dcache_entry* entry;
+    struct nfs_dcache_entry* next;
+    int                      len    = strlen(path);
+
+    pthread_mutex_lock(&dcache->lock);
+    NFS_STORE(dcache->gen, dcache->gen + 1);
+    entry = dcache->lru.next;
+    while (entry != &dcache->lru) {
+        next = entry->next;
+        if (strncmp(entry->path, path, len) == 0
+            && (entry->path[len] == '\0' || entry->path[len] == '/')) {
+            nfs_dcache_del(entry);
+            dcache->invalidate++;
+        }
+        entry = next;
+    }
+    pthread_mutex_unlock(&dcache->lock);
+}
+
+/**
+ * @brief 清空路径缓存，条目在nfs_epoch_destroy时释放
+ */
+void nfs_dcache_destroy() {
+    struct nfs_dcache* dcache = NFS_DCACHE();
+
+    NFS_DBG("[%s] hit: %d, negative hit: %d, miss: %d, evict: %d, invalidate: %d, entries: %d/%d\n",
+            __func__, dcache->hit, dcache->neg_hit, dcache->miss, dcache->evict,
+            dcache->invalidate, dcache->cnt, dcache->max);
+    while (dcache->lru.next != &dcache->lru) {
+        nfs_dcache_del(dcache->lru.next);
+    }
+    pthread_mutex_destroy(&dcache->lock);
+}
@@ -0,0 +1,203 @@
+#include "../include/nfs.h"
+
+/**
+ * @brief 计算文件名的哈希值(FNV-1a)
+ *
+ * @param name 文件名
+ * @return uint32_t
+ */
+uint32_t nfs_name_hash(const char* name) {
+    uint32_t hash = 2166136261u;
+    while (*name) {
+        hash ^= (uint8_t)*name++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * @brief 将目录项插入哈希表，调用者需保证有空槽
+ * 先写hash和len再发布dentry，无锁读者看到非空的dentry时hash和len一定已经有效
+ *
+ * @param htab 哈希表
+ * @param hash 文件名哈希值
+ * @param len 文件名长度
+ * @param dentry 目录项
+ */
+static void nfs_dir_slot_insert(struct nfs_dir_htab* htab, uint32_t hash, int len, struct nfs_dentry* dentry) {
+    int i = hash & (htab->sz - 1);
+    while (htab->slots[i].dentry != NULL) {   // 线性探测
+        i = (i + 1) & (htab->sz - 1);
+    }
+    htab->slots[i].hash = hash;
+    htab->slots[i].len  = len;
+    NFS_STORE(htab->slots[i].dentry, dentry);
+    htab->cnt++;
+}
+
+/**
+ * @brief 分配sz个槽的哈希表并插入old中的所有目录项
+ *
+ * @param old 旧哈希表，可以为NULL
+ * @param sz 新槽数(2的幂)
+ * @return struct nfs_dir_htab* 内存不足时返回NULL
+ */
+static struct nfs_dir_htab* nfs_dir_htab_new(struct nfs_dir_htab* old, int sz) {
+    struct nfs_dir_htab* htab = (struct nfs_dir_htab*)calloc(1, sizeof(struct nfs_dir_htab)
+                                                              + sz * sizeof(struct nfs_dir_slot));
+    if (htab == NULL) {
+        return NULL;
+    }
+    htab->sz = sz;
+    for (int i = 0; old != NULL && i < old->sz; i++) {
+        if (old->slots[i].dentry != NULL) {
+            nfs_dir_slot_insert(htab, old->slots[i].hash, old->slots[i].len, old->slots[i].dentry);
+        }
+    }
+    return htab;
+}
+
+/**
+ * @brief 为目录inode建立子目录项的哈希索引，装载因子不超过1/2
+ * 只在inode发布之前(读入或创建时)调用
+ *
+ * @param inode 目录inode
+ * @return int
+ */
+int nfs_dir_index_build(struct nfs_inode* inode) {
+    struct nfs_dentry* dentry_cursor;
+    int                htab_sz = NFS_DIR_HASH_INIT;
+
+    while (htab_sz < inode->dir_cnt * 2) {
+        htab_sz <<= 1;
+    }
+    free(inode->htab);
+    inode->htab = nfs_dir_htab_new(NULL, htab_sz);
+    if (inode->htab == NULL) {
+        return -NFS_ERROR_NOSPACE;
+    }
+
+    dentry_cursor = inode->dentrys;
+    while (dentry_cursor) {
+        nfs_dir_slot_insert(inode->htab, dentry_cursor->hash, dentry_cursor->name_len, dentry_cursor);
+        dentry_cursor = dentry_cursor->brother;
+    }
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 目录新增子目录项时维护哈希索引，索引尚未建立时不做处理，调用者需持有inode的写锁
+ * 扩容时先建好新表再整体替换，旧表可能仍有读者在探测，交给epoch回收
+ *
+ * @param inode 目录inode
+ * @param dentry 新增的子目录项
+ */
+void nfs_dir_index_add(struct nfs_inode* inode, struct nfs_dentry* dentry) {
+    struct nfs_dir_htab* htab = inode->htab;
+    struct nfs_dir_htab* new_htab;
+
+    if (htab == NULL) {
+        return;
+    }
+    if ((htab->cnt + 1) * 2 > htab->sz) {   // 装载因子超过1/2，扩容
+        new_htab = nfs_dir_htab_new(htab, htab->sz * 2);
+        NFS_STORE(inode->htab, new_htab);   // 扩容失败则丢弃索引，查找退化为遍历链表
+        nfs_epoch_retire(htab, NULL);
+        if (new_htab == NULL) {
+            return;
+        }
+        htab = new_htab;
+    }
+    nfs_dir_slot_insert(htab, dentry->hash, dentry->name_len, dentry);
+}
+
+/**
+ * @brief 在目录inode中按文件名精确查找子目录项，不加锁，调用者需处于epoch临界区内
+ * 目录项只会追加不会删除，读者看到的要么是插入前的状态，要么是插入后的状态
+ * 探测时只比较槽中的哈希值和长度，两者都相同时才访问目录项和文件名
+ *
+ * @param inode 目录inode
+ * @param name 文件名
+ * @return struct nfs_dentry* 找不到返回NULL
+ */
+struct nfs_dentry* nfs_dir_lookup(struct nfs_inode* inode, const char* name) {
+    struct nfs_dir_htab* htab = NFS_LOAD(inode->htab);
+    struct nfs_dentry*   dentry_cursor;
+    uint32_t             hash = nfs_name_hash(name);
+    int                  len  = strlen(name);
+    int                  i;
+
+    if (htab == NULL) {
+        dentry_cursor = NFS_LOAD(inode->dentrys);   // 没有索引(内存不足)时退化为遍历链表
+        while (dentry_cursor) {
+            if (dentry_cursor->hash == hash && dentry_cursor->name_len == len
+                && memcmp(dentry_cursor->name, name, len) == 0) {
+                return dentry_cursor;
+            }
+            dentry_cursor = NFS_LOAD(dentry_cursor->brother);
+        }
+        return NULL;
+    }
+
+    i = hash & (htab->sz - 1);
+    while ((dentry_cursor = NFS_LOAD(htab->slots[i].dentry)) != NULL) {
+        if (htab->slots[i].hash == hash && htab->slots[i].len == len
+            && memcmp(dentry_cursor->name, name, len) == 0) {
+            return dentry_cursor;
+        }
+        i = (i + 1) & (htab->sz - 1);
+    }
+    return NULL;
+}
+
+/**
+ * @brief 将子目录项的文件名追加到目录的文件名存储区，调用者需持有目录inode的写锁或目录inode尚未发布
+ * 存储区只追加不回收，随目录inode一起释放；文件名在目录项发布之前写好，无锁读者总是看到完整的文件名
+ *
+ * @param inode 目录inode
+ * @param name 文件名
+ * @param len 文件名长度
+ * @return char* 存储区中以'\0'结尾的副本，内存不足时返回NULL
+ */
+char* nfs_dir_name_store(struct nfs_inode* inode, const char* name, int len) {
+    struct nfs_name_chunk* chunk = inode->names;
+    int                    cap;
+    char*                  dst;
+
+    if (chunk == NULL || chunk->cap - chunk->used < len + 1) {
+        cap   = len + 1 > NFS_NAME_CHUNK_SZ ? len + 1 : NFS_NAME_CHUNK_SZ;
+        chunk = (struct nfs_name_chunk*)malloc(sizeof(struct nfs_name_chunk) + cap);
+        if (chunk == NULL) {
+            return NULL;
+        }
+        chunk->cap   = cap;
+        chunk->used  = 0;
+        chunk->next  = inode->names;
+        inode->names = chunk;
+        nfs_icache_charge(sizeof(struct nfs_name_chunk) + cap);
+    }
+    dst = chunk->data + chunk->used;
+    memcpy(dst, name, len);
+    dst[len]     = '\0';
+    chunk->used += len + 1;
+    return dst;
+}
+
+/**
+ * @brief 释放目录的文件名存储区，调用者需保证已没有读者访问其子目录项
+ *
+ * @param inode 目录inode
+ * @return long 释放的内存(字节)
+ */
+long nfs_dir_names_free(struct nfs_inode* inode) {
+    struct nfs_name_chunk* chunk;
+    long                   freed = 0;
+
+    while (inode->names != NULL) {
+        chunk        = inode->names;
+        inode->names = chunk->next;
+        freed       += sizeof(struct nfs_name_chunk) + chunk->cap;
+        free(chunk);
+    }
+    return freed;
+}
@@ -0,0 +1,171 @@
+#include "../include/nfs.h"
+
+/*
+ * 基于epoch的内存回收
+ * 读者在nfs_epoch_enter/nfs_epoch_exit之间不加锁地访问目录项哈希表、路径缓存等共享结构，
+ * 写者把摘下的对象交给nfs_epoch_retire，等所有读者都离开了摘下时的epoch之后再释放。
+ * 在epoch e中被摘下的对象，当全局epoch推进到e + 2时不可能再被任何读者持有。
+ */
+
+#define NFS_EPOCH_LISTS                 3
+#define NFS_EPOCH_ACTIVE                0x1ULL   // state的最低位表示线程处于读临界区，其余位为进入时的epoch
+
+struct nfs_epoch_rec {
+    uint64_t               state;   // (epoch << 1) | active
+    int                    owned;   // 是否已被某个线程占用
+    int                    nest;   // 临界区嵌套深度
+    struct nfs_epoch_rec*  next;
+};
+
+struct nfs_epoch_node {
+    void*                  ptr;
+    void                   (*free_fn)(void*);
+    struct nfs_epoch_node* next;
+};
+
+static uint64_t               nfs_epoch_global = 0;
+static struct nfs_epoch_rec*  nfs_epoch_recs = NULL;   // 所有线程的记录，只增不减
+static struct nfs_epoch_node* nfs_epoch_limbo[NFS_EPOCH_LISTS];   // 按摘下时的epoch分组的待释放对象
+static pthread_mutex_t        nfs_epoch_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t          nfs_epoch_key;
+static pthread_once_t         nfs_epoch_once = PTHREAD_ONCE_INIT;
+static __thread struct nfs_epoch_rec* nfs_epoch_self = NULL;
+
+// 线程退出时归还记录，供之后新建的线程复用(FUSE会动态创建和回收工作线程)
+static void nfs_epoch_rec_release(void* arg) {
+    struct nfs_epoch_rec* rec = (struct nfs_epoch_rec*)arg;
+    __atomic_store_n(&rec->state, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&rec->owned, 0, __ATOMIC_RELEASE);
+}
+
+static void nfs_epoch_key_init() {
+    pthread_key_create(&nfs_epoch_key, nfs_epoch_rec_release);
+}
+
+/**
+ * @brief 获取当前线程的记录，首次调用时占用一个空闲记录或新建一个
+ *
+ * @return struct nfs_epoch_rec*
+ */
+static struct nfs_epoch_rec* nfs_epoch_rec_get() {
+    struct nfs_epoch_rec* rec;
+    int                   expected;
+
+    if (nfs_epoch_self != NULL) {
+        return nfs_epoch_self;
+    }
+    pthread_once(&nfs_epoch_once, nfs_epoch_key_init);
+    for (rec = __atomic_load_n(&nfs_epoch_recs, __ATOMIC_ACQUIRE); rec != NULL; rec = rec->next) {
+        expected = 0;
+        if (__atomic_compare_exchange_n(&rec->owned, &expected, 1, FALSE,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+    if (rec == NULL) {
+        rec = (struct nfs_epoch_rec*)calloc(1, sizeof(struct nfs_epoch_rec));
+        rec->owned = 1;
+        pthread_mutex_lock(&nfs_epoch_lock);
+        rec->next = nfs_epoch_recs;
+        __atomic_store_n(&nfs_epoch_recs, rec, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&nfs_epoch_lock);
+    }
+    pthread_setspecific(nfs_epoch_key, rec);
+    nfs_epoch_self = rec;
+    return rec;
+}
+
+/**
+ * @brief 进入读临界区，期间读到的共享对象不会被释放，可以嵌套
+ */
+void nfs_epoch_enter() {
+    struct nfs_epoch_rec* rec = nfs_epoch_rec_get();
+    uint64_t              epoch;
+
+    if (rec->nest++ > 0) {
+        return;
+    }
+    epoch = __atomic_load_n(&nfs_epoch_global, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&rec->state, (epoch << 1) | NFS_EPOCH_ACTIVE, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+/**
+ * @brief 离开读临界区
+ */
+void nfs_epoch_exit() {
+    struct nfs_epoch_rec* rec = nfs_epoch_self;
+
+    if (--rec->nest > 0) {
+        return;
+    }
+    __atomic_store_n(&rec->state, 0, __ATOMIC_RELEASE);
+}
+
+// 释放一组待释放对象
+static void nfs_epoch_free_list(struct nfs_epoch_node* node) {
+    struct nfs_epoch_node* next;
+    while (node != NULL) {
+        next = node->next;
+        node->free_fn(node->ptr);
+        free(node);
+        node = next;
+    }
+}
+
+/**
+ * @brief 所有处于临界区的线程都已进入当前epoch时推进全局epoch，
+ * 并释放两个epoch之前摘下的对象，调用者需持有nfs_epoch_lock
+ */
+static void nfs_epoch_try_advance() {
+    struct nfs_epoch_rec*  rec;
+    struct nfs_epoch_node* expired;
+    uint64_t               epoch = nfs_epoch_global;
+    uint64_t               state;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for (rec = nfs_epoch_recs; rec != NULL; rec = rec->next) {
+        state = __atomic_load_n(&rec->state, __ATOMIC_ACQUIRE);
+        if ((state & NFS_EPOCH_ACTIVE) && (state >> 1) != epoch) {
+            return;   // 仍有读者停留在上一个epoch
+        }
+    }
+    __atomic_store_n(&nfs_epoch_global, epoch + 1, __ATOMIC_RELEASE);
+    expired = nfs_epoch_limbo[(epoch + 2) % NFS_EPOCH_LISTS];   // 即epoch - 1时摘下的对象
+    nfs_epoch_limbo[(epoch + 2) % NFS_EPOCH_LISTS] = NULL;
+    nfs_epoch_free_list(expired);
+}
+
+/**
+ * @brief 延迟释放一个已从共享结构中摘下的对象，所有可能持有它的读者离开后调用free_fn
+ *
+ * @param ptr 对象
+ * @param free_fn 释放函数，NULL表示free
+ */
+void nfs_epoch_retire(void* ptr, void (*free_fn)(void*)) {
+    struct nfs_epoch_node* node;
+
+    if (ptr == NULL) {
+        return;
+    }
+    node          = (struct nfs_epoch_node*)malloc(sizeof(struct nfs_epoch_node));
+    node->ptr     = ptr;
+    node->free_fn = free_fn != NULL ? free_fn : free;
+    pthread_mutex_lock(&nfs_epoch_lock);
+    node->next = nfs_epoch_limbo[nfs_epoch_global % NFS_EPOCH_LISTS];
+    nfs_epoch_limbo[nfs_epoch_global % NFS_EPOCH_LISTS] = node;
+    nfs_epoch_try_advance();
+    pthread_mutex_unlock(&nfs_epoch_lock);
+}
+
+/**
+ * @brief 卸载时释放所有待释放对象，调用时不能再有读者
+ */
+void nfs_epoch_destroy() {
+    pthread_mutex_lock(&nfs_epoch_lock);
+    for (int i = 0; i < NFS_EPOCH_LISTS; i++) {
+        nfs_epoch_free_list(nfs_epoch_limbo[i]);
+        nfs_epoch_limbo[i] = NULL;
+    }
+    pthread_mutex_unlock(&nfs_epoch_lock);
+}
@@ -0,0 +1,151 @@
+#include "../include/nfs.h"
+
+extern struct nfs_super      nfs_super;
+
+/*
+ * 后台写回
+ * 写操作只在内存中修改数据块并记入脏inode链表，由后台写回线程负责写到设备:
+ *   1. 每隔flush_interval秒，有脏了超过flush_interval秒的inode时提交日志并做检查点
+ *   2. 脏块数超过dirty_bg(上限的一半)时被立即唤醒，提交所有脏数据并做检查点
+ * 前台写操作只有在脏块数超过dirty_limit时才等待写回，等待前必须释放所有inode锁
+ * 写回失败时没有请求可以直接报告，记入写回错误序号，之后由打开了文件的flush(close)或fsync报告
+ */
+
+/**
+ * @brief 后台写回线程
+ *
+ * @param arg
+ * @return void*
+ */
+static void* nfs_flusher(void* arg) {
+    struct timespec deadline;
+
+    pthread_mutex_lock(&nfs_super.flush_lock);
+    while (!nfs_super.flush_stop) {
+        if (!nfs_super.flush_kicked) {
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += nfs_super.flush_interval;
+            pthread_cond_timedwait(&nfs_super.flush_cond, &nfs_super.flush_lock, &deadline);
+        }
+        if (nfs_super.flush_stop) {
+            break;
+        }
+        nfs_super.flush_kicked = FALSE;
+        pthread_mutex_unlock(&nfs_super.flush_lock);
+
+        if (nfs_sync_dirty(time(NULL) - nfs_super.flush_interval, nfs_super.dirty_bg) < 0) {
+            NFS_DBG("[%s] write back error\n", __func__);
+        }
+        nfs_icache_balance();   // 写回之后变干净的inode和数据块可以被回收
+
+        pthread_mutex_lock(&nfs_super.flush_lock);
+        pthread_cond_broadcast(&nfs_super.flush_done);
+    }
+    pthread_mutex_unlock(&nfs_super.flush_lock);
+    return NULL;
+}
+
+/**
+ * @brief 设置脏数据阈值并启动后台写回线程，在挂载完成后调用
+ *
+ * @param interval 写回周期(秒)，0表示不启动线程，只在超过上限时由前台同步写回
+ * @param limit_kb 脏数据上限(KB)，0表示不限制
+ * @return int
+ */
+int nfs_flush_start(int interval, int limit_kb) {
+    int limit = limit_kb * 1024 / NFS_BLKS_SZ(1);
+
+    nfs_super.dirty_limit    = limit > 0 ? limit : INT_MAX;
+    nfs_super.dirty_bg       = limit > 0 ? limit / 2 : INT_MAX;
+    nfs_super.flush_interval = interval;
+    nfs_super.flusher_on     = FALSE;
+    nfs_super.flush_stop     = FALSE;
+    nfs_super.flush_kicked   = FALSE;
+    pthread_mutex_init(&nfs_super.flush_lock, NULL);
+    pthread_cond_init(&nfs_super.flush_cond, NULL);
+    pthread_cond_init(&nfs_super.flush_done, NULL);
+
+    if (interval <= 0) {
+        return NFS_ERROR_NONE;
+    }
+    if (pthread_create(&nfs_super.flusher, NULL, nfs_flusher, NULL) != 0) {
+        NFS_DBG("[%s] create flusher failed, write back at unmount only\n", __func__);
+        return NFS_ERROR_NONE;
+    }
+    nfs_super.flusher_on = TRUE;
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 停止后台写回线程，剩余的脏数据由卸载流程写回
+ */
+void nfs_flush_stop() {
+    pthread_mutex_lock(&nfs_super.flush_lock);
+    nfs_super.flush_stop = TRUE;
+    pthread_cond_signal(&nfs_super.flush_cond);
+    pthread_cond_broadcast(&nfs_super.flush_done);
+    pthread_mutex_unlock(&nfs_super.flush_lock);
+    if (nfs_super.flusher_on) {
+        pthread_join(nfs_super.flusher, NULL);
+        nfs_super.flusher_on = FALSE;
+    }
+    pthread_cond_destroy(&nfs_super.flush_done);
+    pthread_cond_destroy(&nfs_super.flush_cond);
+    pthread_mutex_destroy(&nfs_super.flush_lock);
+}
+
+/**
+ * @brief 要求后台写回线程立即开始一轮写回，不等待
+ */
+void nfs_flush_kick() {
+    if (!nfs_super.flusher_on) {
+        return;
+    }
+    pthread_mutex_lock(&nfs_super.flush_lock);
+    nfs_super.flush_kicked = TRUE;
+    pthread_cond_signal(&nfs_super.flush_cond);
+    pthread_mutex_unlock(&nfs_super.flush_lock);
+}
+
+/**
+ * @brief 脏块数超过上限时等待写回，前台写操作在释放inode锁之后调用
+ */
+void nfs_flush_throttle() {
+    if (NFS_LOAD(nfs_super.dirty_blks) <= nfs_super.dirty_limit) {
+        return;
+    }
+    if (!nfs_super.flusher_on) {   // 没有后台写回线程，由当前线程同步写回到阈值以下
+        nfs_sync_dirty(0, nfs_super.dirty_bg);
+        return;
+    }
+    pthread_mutex_lock(&nfs_super.flush_lock);
+    while (NFS_LOAD(nfs_super.dirty_blks) > nfs_super.dirty_limit && !nfs_super.flush_stop) {
+        nfs_super.flush_kicked = TRUE;
+        pthread_cond_signal(&nfs_super.flush_cond);
+        pthread_cond_wait(&nfs_super.flush_done, &nfs_super.flush_lock);
+    }
+    pthread_mutex_unlock(&nfs_super.flush_lock);
+}
+
+/**
+ * @brief 记录一次写回失败，提交日志失败时调用
+ */
+void nfs_flush_error() {
+    __atomic_add_fetch(&nfs_super.wb_err, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief 报告句柄打开之后(或上次报告之后)发生的写回失败，每次失败对每个句柄只报告一次
+ *
+ * @param fh 打开文件的句柄
+ * @return int 有未报告的写回失败时返回-NFS_ERROR_IO
+ */
+int nfs_flush_check(struct nfs_fhandle* fh) {
+    int err = NFS_LOAD(nfs_super.wb_err);
+
+    if (NFS_LOAD(fh->wb_err) == err) {
+        return NFS_ERROR_NONE;
+    }
+    NFS_STORE(fh->wb_err, err);
+    return -NFS_ERROR_IO;
+}
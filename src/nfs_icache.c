@@ -0,0 +1,308 @@
+#include "../include/nfs.h"
+
+extern struct nfs_super      nfs_super;
+
+#define NFS_ICACHE()                    (&nfs_super.icache)
+
+/*
+ * inode缓存
+ * inode在第一次被访问时读入，普通文件的数据块在读写时才按需读入(见nfs_inode_block)，
+ * inode、目录项和数据块缓冲区占用的内存超过预算时按CLOCK策略回收:
+ *   1. 丢弃干净的数据块缓冲区，之后访问时重新经块缓存读入
+ *   2. 没有句柄引用、没有脏数据、不是根目录，且(对目录)所有子目录项的inode都已回收的inode整体淘汰:
+ *      目录项的inode指针置为NULL，inode连同它的子目录项交给epoch回收，之后访问时重新读入
+ * 淘汰自底向上进行，已读入的inode的父目录一定也在内存中。
+ * 回收时持有日志的txn_lock写锁，此时没有修改文件系统的操作在进行，
+ * 只需与无锁的读者(epoch)、持有读锁的读者(trylock)和持有句柄的读写(引用计数)同步
+ */
+
+/**
+ * @brief 初始化inode缓存
+ *
+ * @param limit_kb 内存预算(KB)，0表示不限制
+ */
+void nfs_icache_init(int limit_kb) {
+    struct nfs_icache* icache = NFS_ICACHE();
+    memset(icache, 0, sizeof(struct nfs_icache));
+    icache->max = limit_kb > 0 ? (long)limit_kb * 1024 : LONG_MAX;
+}
+
+/**
+ * @brief 记录inode缓存占用内存的变化
+ *
+ * @param bytes 新分配为正，释放为负
+ */
+void nfs_icache_charge(long bytes) {
+    __atomic_add_fetch(&NFS_ICACHE()->mem, bytes, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief 将新读入或新建的inode加入可淘汰链表(插在CLOCK指针之前，最后才被扫描到)，调用者需持有load_lock
+ * 所在目录已被淘汰时不加入，它随所在目录一起回收，它的子目录项也标记为detached
+ *
+ * @param inode
+ */
+void nfs_icache_add(struct nfs_inode* inode) {
+    struct nfs_icache* icache = NFS_ICACHE();
+    struct nfs_dentry* dentry_cursor;
+
+    NFS_STORE(inode->referenced, 1);
+    inode->lru_prev   = NULL;
+    inode->lru_next   = NULL;
+    if (inode->dentry->parent == NULL) {   // 根目录常驻内存
+        return;
+    }
+    if (inode->dentry->detached) {
+        for (dentry_cursor = inode->dentrys; dentry_cursor != NULL; dentry_cursor = dentry_cursor->brother) {
+            NFS_STORE(dentry_cursor->detached, TRUE);
+        }
+        return;
+    }
+    if (icache->hand == NULL) {
+        inode->lru_prev = inode;
+        inode->lru_next = inode;
+        icache->hand    = inode;
+    }
+    else {
+        inode->lru_next = icache->hand;
+        inode->lru_prev = icache->hand->lru_prev;
+        icache->hand->lru_prev->lru_next = inode;
+        icache->hand->lru_prev = inode;
+    }
+    icache->cnt++;
+}
+
+/**
+ * @brief 将inode从可淘汰链表中摘下，调用者需持有load_lock
+ *
+ * @param inode
+ */
+void nfs_icache_del(struct nfs_inode* inode) {
+    struct nfs_icache* icache = NFS_ICACHE();
+
+    if (inode->lru_next == NULL) {
+        return;
+    }
+    if (inode->lru_next == inode) {
+        icache->hand = NULL;
+    }
+    else {
+        inode->lru_prev->lru_next = inode->lru_next;
+        inode->lru_next->lru_prev = inode->lru_prev;
+        if (icache->hand == inode) {
+            icache->hand = inode->lru_next;
+        }
+    }
+    inode->lru_prev = NULL;
+    inode->lru_next = NULL;
+    icache->cnt--;
+}
+
+/**
+ * @brief 释放被淘汰的inode及其子目录项，由epoch回收调用，也用于回收读入失败的inode
+ * 淘汰之后仍在临界区内的读者可能又在子目录项中读入了inode，这些inode没有加入链表，一并释放
+ *
+ * @param ptr 被淘汰的inode
+ */
+void nfs_icache_free(void* ptr) {
+    struct nfs_inode*  inode = (struct nfs_inode*)ptr;
+    struct nfs_dentry* dentry_cursor = inode->dentrys;
+    struct nfs_dentry* next;
+    long               freed = sizeof(struct nfs_inode);
+
+    while (dentry_cursor != NULL) {
+        next = dentry_cursor->brother;
+        if (dentry_cursor->inode != NULL) {
+            nfs_icache_free(dentry_cursor->inode);
+        }
+        nfs_slab_free(&nfs_super.dentry_slab, dentry_cursor);
+        freed += sizeof(struct nfs_dentry);
+        dentry_cursor = next;
+    }
+    for (int i = 0; i < inode->block_cap; i++) {
+        if (inode->block_pointer[i] != NULL) {
+            free(inode->block_pointer[i]);
+            freed += NFS_BLKS_SZ(1);
+        }
+    }
+    free(inode->block_pointer);
+    free(inode->block_dirty);
+    free(inode->extents);
+    free(inode->htab);
+    freed += nfs_dir_names_free(inode);
+    pthread_rwlock_destroy(&inode->lock);
+    nfs_slab_free(&nfs_super.inode_slab, inode);
+    nfs_icache_charge(-freed);
+}
+
+/**
+ * @brief 丢弃普通文件中干净的数据块缓冲区，调用者需持有inode写锁
+ *
+ * @param inode
+ * @return long 释放的内存(字节)
+ */
+static long nfs_icache_drop_blocks(struct nfs_inode* inode) {
+    long freed = 0;
+
+    if (!NFS_IS_REG(inode) || NFS_IS_INLINE(inode)) {   // 内嵌内容不能从数据块重新读入
+        return 0;
+    }
+    for (int i = 0; i < inode->block_cap; i++) {
+        if (inode->block_pointer[i] != NULL && !inode->block_dirty[i]) {
+            free(inode->block_pointer[i]);
+            inode->block_pointer[i] = NULL;
+            freed += NFS_BLKS_SZ(1);
+            NFS_ICACHE()->drop++;
+        }
+    }
+    nfs_icache_charge(-freed);
+    return freed;
+}
+
+/**
+ * @brief 尝试将inode从目录项上摘下，调用者需持有load_lock和inode写锁
+ * 与nfs_fhandle_get构成Dekker式同步: 先摘下再检查引用计数，句柄先加引用计数再检查目录项，
+ * 两者至少有一方能看到对方的修改
+ *
+ * @param inode
+ * @return boolean 是否摘下
+ */
+static boolean nfs_icache_detach(struct nfs_inode* inode) {
+    struct nfs_dentry* dentry = inode->dentry;
+    struct nfs_dentry* dentry_cursor;
+
+    if (dentry->parent == NULL || NFS_LOAD(inode->ref) > 0 || inode->dirty != 0) {
+        return FALSE;
+    }
+    for (dentry_cursor = inode->dentrys; dentry_cursor != NULL; dentry_cursor = dentry_cursor->brother) {
+        if (dentry_cursor->inode != NULL) {   // 子目录项的inode尚未回收
+            return FALSE;
+        }
+    }
+    __atomic_store_n(&dentry->inode, NULL, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&inode->ref, __ATOMIC_SEQ_CST) > 0) {   // 与打开并发，放弃淘汰
+        __atomic_store_n(&dentry->inode, inode, __ATOMIC_SEQ_CST);
+        return FALSE;
+    }
+    for (dentry_cursor = inode->dentrys; dentry_cursor != NULL; dentry_cursor = dentry_cursor->brother) {
+        NFS_STORE(dentry_cursor->detached, TRUE);
+    }
+    nfs_icache_del(inode);
+    return TRUE;
+}
+
+/**
+ * @brief 构造目录项的完整路径，用于使路径缓存失效
+ *
+ * @param dentry
+ * @return char*
+ */
+static char* nfs_icache_path(struct nfs_dentry* dentry) {
+    struct nfs_dentry* dentry_cursor;
+    int                len = 0;
+    char*              path;
+
+    for (dentry_cursor = dentry; dentry_cursor->parent != NULL; dentry_cursor = dentry_cursor->parent) {
+        len += dentry_cursor->name_len + 1;
+    }
+    path = (char*)malloc(len + 1);
+    path[len] = '\0';
+    for (dentry_cursor = dentry; dentry_cursor->parent != NULL; dentry_cursor = dentry_cursor->parent) {
+        len -= dentry_cursor->name_len;
+        memcpy(path + len, dentry_cursor->name, dentry_cursor->name_len);
+        path[--len] = '/';
+    }
+    return path;
+}
+
+/**
+ * @brief 按CLOCK策略回收，直到占用的内存降到target以下或扫描完两圈，调用者需持有txn_lock写锁
+ *
+ * @param target 目标内存占用(字节)
+ */
+static void nfs_icache_shrink(long target) {
+    struct nfs_icache* icache  = NFS_ICACHE();
+    struct nfs_inode*  victims = NULL;   // 本轮淘汰的inode，用lru_next串起
+    struct nfs_inode*  inode;
+    long               pending = 0;   // 已淘汰但尚未释放的内存
+    char*              path;
+    int                scan;
+
+    pthread_mutex_lock(&nfs_super.load_lock);
+    for (scan = icache->cnt * 2; scan > 0 && icache->hand != NULL; scan--) {
+        if (NFS_LOAD(icache->mem) - pending <= target) {
+            break;
+        }
+        inode        = icache->hand;
+        icache->hand = inode->lru_next;
+        if (__atomic_exchange_n(&inode->referenced, 0, __ATOMIC_RELAXED)) {
+            continue;   // 最近被访问过，给第二次机会
+        }
+        if (pthread_rwlock_trywrlock(&inode->lock) != 0) {
+            continue;   // 正在被读
+        }
+        nfs_icache_drop_blocks(inode);
+        if (nfs_icache_detach(inode)) {
+            pending += sizeof(struct nfs_inode) + inode->dir_cnt * sizeof(struct nfs_dentry);
+            inode->lru_next = victims;
+            victims         = inode;
+            icache->evict++;
+        }
+        pthread_rwlock_unlock(&inode->lock);
+    }
+    pthread_mutex_unlock(&nfs_super.load_lock);
+
+    // 被淘汰目录下的路径缓存条目指向即将释放的子目录项，先使其失效再回收
+    for (inode = victims; inode != NULL; inode = inode->lru_next) {
+        if (NFS_IS_DIR(inode) && inode->dentrys != NULL) {
+            path = nfs_icache_path(inode->dentry);
+            nfs_dcache_invalidate_prefix(path);
+            free(path);
+        }
+    }
+    while (victims != NULL) {
+        inode   = victims;
+        victims = inode->lru_next;
+        inode->lru_next = NULL;
+        nfs_epoch_retire(inode, nfs_icache_free);
+    }
+}
+
+/**
+ * @brief 占用的内存超过预算时回收到预算的3/4，在操作结束、不持有任何锁且不在epoch临界区内时调用
+ */
+void nfs_icache_balance() {
+    struct nfs_icache* icache = NFS_ICACHE();
+
+    if (NFS_LOAD(icache->mem) <= icache->max) {
+        return;
+    }
+    if (__atomic_exchange_n(&icache->shrinking, 1, __ATOMIC_ACQUIRE)) {
+        return;   // 已有线程在回收
+    }
+    nfs_journal_lock();
+    nfs_icache_shrink(icache->max / 4 * 3);
+    nfs_journal_unlock();
+    __atomic_store_n(&icache->shrinking, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief 卸载时输出统计信息并释放整棵inode树，调用者需保证已没有其他线程访问文件系统
+ */
+void nfs_icache_destroy() {
+    struct nfs_icache* icache = NFS_ICACHE();
+    struct nfs_dentry* root   = nfs_super.root_dentry;
+
+    NFS_DBG("[%s] inodes: %d, memory: %ldKB/%ldKB, evict: %d, drop: %d\n",
+            __func__, icache->cnt, icache->mem / 1024,
+            icache->max == LONG_MAX ? 0 : icache->max / 1024, icache->evict, icache->drop);
+    if (root != NULL) {
+        if (root->inode != NULL) {
+            nfs_icache_free(root->inode);
+        }
+        nfs_slab_free(&nfs_super.dentry_slab, root);
+        nfs_super.root_dentry = NULL;
+    }
+    icache->hand = NULL;
+    icache->cnt  = 0;
+}
@@ -0,0 +1,435 @@
+#include "../include/nfs.h"
+
+extern struct nfs_super      nfs_super;
+
+#define NFS_JOURNAL()                   (&nfs_super.journal)
+
+/*
+ * 元数据日志(redo)
+ * 日志区的第一个块为日志头，记录下一个待重放的事务序号；之后依次追加事务，每个事务为
+ * 一个事务头块加上若干元数据块的完整镜像，事务头中的校验和覆盖事务头和所有镜像，写了一半的事务校验失败。
+ *
+ * 元数据(inode表、位图、目录项块、溢出extent块)写入块缓存时被标记为NFS_FLAG_BUF_META，
+ * 在写入日志之前不会被写回原位置；写入日志后改为NFS_FLAG_BUF_LOGGED，可以随时写回原位置。
+ * 检查点将所有脏块写回原位置后清空日志。挂载时重放日志中完整的事务。
+ *
+ * 修改文件系统的操作在nfs_journal_begin/nfs_journal_end之间进行，提交时持有txn_lock写锁
+ * 把所有脏inode和位图写入块缓存，保证一个事务只包含完整的操作。
+ * 同时到来的多个提交请求由一个线程一次写入日志(group commit)。
+ *
+ * 目录项块、溢出extent块位于数据区，释放后可能被重新分配为文件数据，
+ * 因此释放日志中仍有镜像的块之前先做检查点，避免重放时旧镜像覆盖新内容。
+ */
+
+// FNV-1a，用于事务校验
+static uint32_t nfs_journal_csum(uint32_t csum, const uint8_t* data, int size) {
+    for (int i = 0; i < size; i++) {
+        csum ^= data[i];
+        csum *= 16777619u;
+    }
+    return csum;
+}
+
+/**
+ * @brief 直接读写日志区，日志块不经过块缓存，调用者需持有块缓存锁(与块缓存共用设备的读写位置)
+ *
+ * @param blk 日志区内的块号
+ * @param data 内容
+ * @param n 块数
+ * @param is_write 是否为写
+ * @return int
+ */
+static int nfs_journal_io(int blk, uint8_t* data, int n, boolean is_write) {
+    if (ddriver_seek(NFS_DRIVER(), NFS_BLKS_SZ(NFS_JOURNAL()->offset + blk), SEEK_SET) < 0) {
+        return -NFS_ERROR_SEEK;
+    }
+    for (int i = 0; i < NFS_BLKS_SZ(n); i += NFS_IO_SZ()) {
+        if ((is_write ? ddriver_write(NFS_DRIVER(), (char*)data + i, NFS_IO_SZ())
+                      : ddriver_read(NFS_DRIVER(), (char*)data + i, NFS_IO_SZ())) < 0) {
+            return -NFS_ERROR_IO;
+        }
+    }
+    return NFS_ERROR_NONE;
+}
+
+// 写日志头，日志头之后的事务从seq开始才有效，调用者需持有块缓存锁
+static int nfs_journal_write_head(uint32_t seq) {
+    uint8_t                   blk_buf[NFS_BLKS_SZ(1)];
+    struct nfs_journal_sb_d*  jsb = (struct nfs_journal_sb_d*)blk_buf;
+
+    memset(blk_buf, 0, NFS_BLKS_SZ(1));
+    jsb->magic = NFS_JOURNAL_MAGIC;
+    jsb->seq   = seq;
+    return nfs_journal_io(0, blk_buf, 1, TRUE);
+}
+
+/**
+ * @brief 检查点: 将所有已写入日志的元数据和其他脏块写回原位置，然后清空日志，调用者需持有块缓存锁
+ *
+ * @return int 写回的块数，失败返回错误码
+ */
+static int nfs_journal_checkpoint() {
+    struct nfs_journal* journal = NFS_JOURNAL();
+    int                 cnt     = nfs_bcache_sync();
+
+    if (cnt < 0) {
+        return cnt;
+    }
+    if (journal->head > 1) {
+        if (nfs_journal_write_head(journal->seq) != NFS_ERROR_NONE) {
+            return -NFS_ERROR_IO;
+        }
+        journal->head     = 1;
+        journal->live_cnt = 0;
+        journal->checkpoints++;
+    }
+    return cnt;
+}
+
+/**
+ * @brief 将块缓存中所有未提交的元数据块作为一个事务顺序写入日志，调用者需持有块缓存锁
+ * 元数据块数不会超过nfs_bcache_meta_max设置的上限，保证一个事务放得进空的日志区
+ *
+ * @return int 写入日志的块数，失败返回错误码
+ */
+static int nfs_journal_write_txn() {
+    struct nfs_journal*       journal = NFS_JOURNAL();
+    struct nfs_buf**          bufs;
+    struct nfs_journal_txn_d* txn;
+    uint8_t*                  blks;
+    int                       n, ret = NFS_ERROR_NONE;
+
+    bufs = (struct nfs_buf**)malloc(journal->blks * sizeof(struct nfs_buf*));
+    n    = nfs_bcache_meta(bufs, journal->blks);
+    if (n == 0) {
+        free(bufs);
+        return 0;
+    }
+    if (journal->head + 1 + n > journal->blks) {   // 日志剩余空间不足，先做检查点
+        ret = nfs_journal_checkpoint();
+        if (ret < 0) {
+            free(bufs);
+            return ret;
+        }
+    }
+    blks = (uint8_t*)calloc(1 + n, NFS_BLKS_SZ(1));
+    txn  = (struct nfs_journal_txn_d*)blks;
+    txn->magic = NFS_JOURNAL_TXN_MAGIC;
+    txn->seq   = journal->seq;
+    txn->nr    = n;
+    for (int i = 0; i < n; i++) {
+        txn->blks[i] = bufs[i]->blk;
+        memcpy(blks + NFS_BLKS_SZ(1 + i), bufs[i]->data, NFS_BLKS_SZ(1));
+    }
+    txn->csum = nfs_journal_csum(2166136261u, blks, NFS_BLKS_SZ(1 + n));
+
+    ret = nfs_journal_io(journal->head, blks, 1 + n, TRUE);   // 事务头和镜像一次顺序写入
+    if (ret == NFS_ERROR_NONE) {
+        nfs_bcache_logged(bufs, n);
+        for (int i = 0; i < n; i++) {
+            journal->live[journal->live_cnt++] = bufs[i]->blk;
+        }
+        journal->head += 1 + n;
+        journal->seq++;
+        journal->commits++;
+        journal->logged += 1 + n;
+    }
+    free(blks);
+    free(bufs);
+    return ret != NFS_ERROR_NONE ? ret : 1 + n;
+}
+
+/**
+ * @brief 初始化日志，格式化时写入空的日志头，否则重放日志中完整的事务，需在读取位图之前调用
+ *
+ * @param offset 日志区起始逻辑块号
+ * @param blks 日志区块数
+ * @param is_init 是否为新格式化的磁盘
+ * @return int
+ */
+int nfs_journal_init(int offset, int blks, boolean is_init) {
+    struct nfs_journal*       journal = NFS_JOURNAL();
+    struct nfs_journal_sb_d*  jsb;
+    struct nfs_journal_txn_d* txn;
+    pthread_rwlockattr_t      attr;
+    uint8_t*                  blk_buf = (uint8_t*)malloc(NFS_BLKS_SZ(blks));
+    uint32_t                  csum;
+    int                       pos = 1, replayed = 0, ret = NFS_ERROR_NONE;
+
+    memset(journal, 0, sizeof(struct nfs_journal));
+    journal->offset = offset;
+    journal->blks   = blks;
+    journal->head   = 1;
+    journal->seq    = is_init ? (uint32_t)time(NULL) : 1;   // 格式化时不同的起始序号，残留的旧事务不会被误认
+    journal->live   = (int*)malloc(blks * sizeof(int));
+    pthread_mutex_init(&journal->lock, NULL);
+    pthread_cond_init(&journal->cond, NULL);
+    pthread_rwlockattr_init(&attr);
+    // 写者优先，持续不断的写操作不会让提交一直等下去
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(&journal->txn_lock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+    nfs_bcache_meta_max(blks - 2);   // 一个事务最多包含的元数据块数
+
+    nfs_bcache_lock();
+    if (is_init) {
+        ret = nfs_journal_write_head(journal->seq);
+        nfs_bcache_unlock();
+        free(blk_buf);
+        return ret;
+    }
+    jsb = (struct nfs_journal_sb_d*)blk_buf;
+    if (nfs_journal_io(0, blk_buf, 1, FALSE) != NFS_ERROR_NONE || jsb->magic != NFS_JOURNAL_MAGIC) {
+        nfs_bcache_unlock();
+        free(blk_buf);
+        return -NFS_ERROR_IO;
+    }
+    journal->seq = jsb->seq;
+
+    // 依次重放序号连续且校验通过的事务，遇到第一个不完整的事务为止
+    txn = (struct nfs_journal_txn_d*)blk_buf;
+    while (pos + 1 < blks) {
+        if (nfs_journal_io(pos, blk_buf, 1, FALSE) != NFS_ERROR_NONE
+            || txn->magic != NFS_JOURNAL_TXN_MAGIC || txn->seq != journal->seq
+            || txn->nr <= 0 || pos + 1 + txn->nr > blks
+            || nfs_journal_io(pos + 1, blk_buf + NFS_BLKS_SZ(1), txn->nr, FALSE) != NFS_ERROR_NONE) {
+            break;
+        }
+        csum      = txn->csum;
+        txn->csum = 0;
+        if (nfs_journal_csum(2166136261u, blk_buf, NFS_BLKS_SZ(1 + txn->nr)) != csum) {
+            break;
+        }
+        for (int i = 0; i < txn->nr && ret == NFS_ERROR_NONE; i++) {
+            ret = nfs_driver_write(NFS_BLKS_SZ(txn->blks[i]), blk_buf + NFS_BLKS_SZ(1 + i), NFS_BLKS_SZ(1));
+        }
+        pos += 1 + txn->nr;
+        journal->seq++;
+        replayed++;
+    }
+    if (replayed > 0 && ret == NFS_ERROR_NONE) {   // 重放的块写回原位置后才能清空日志
+        if (nfs_bcache_sync() < 0 || nfs_journal_write_head(journal->seq) != NFS_ERROR_NONE) {
+            ret = -NFS_ERROR_IO;
+        }
+        NFS_DBG("[%s] replayed %d transactions\n", __func__, replayed);
+    }
+    nfs_bcache_unlock();
+    free(blk_buf);
+    return ret;
+}
+
+/**
+ * @brief 开始一个修改文件系统的操作，与提交互斥，调用期间不能再调用nfs_journal_commit
+ */
+void nfs_journal_begin() {
+    pthread_rwlock_rdlock(&NFS_JOURNAL()->txn_lock);
+}
+
+/**
+ * @brief 结束一个修改文件系统的操作
+ */
+void nfs_journal_end() {
+    pthread_rwlock_unlock(&NFS_JOURNAL()->txn_lock);
+}
+
+/**
+ * @brief 等待所有修改文件系统的操作结束并阻止新的操作开始，用于回收inode缓存
+ */
+void nfs_journal_lock() {
+    pthread_rwlock_wrlock(&NFS_JOURNAL()->txn_lock);
+}
+
+/**
+ * @brief 允许修改文件系统的操作继续
+ */
+void nfs_journal_unlock() {
+    pthread_rwlock_unlock(&NFS_JOURNAL()->txn_lock);
+}
+
+/**
+ * @brief 提交: 把此前完成的所有操作写入日志，返回时这些操作已持久化
+ * 文件数据先写回原位置，再顺序写入一个包含所有脏元数据的事务；
+ * 正在提交时到来的请求等待其结束，之后由其中一个线程一次提交所有请求
+ *
+ * @param checkpoint 提交后是否做检查点(写回原位置并清空日志)
+ * @return int 写入设备的块数，失败返回错误码
+ */
+int nfs_journal_commit(boolean checkpoint) {
+    struct nfs_journal* journal = NFS_JOURNAL();
+    uint32_t            ticket, upto;
+    int                 inode_cnt, data_cnt, log_cnt, ckpt_cnt = 0;
+
+    pthread_mutex_lock(&journal->lock);
+    ticket = ++journal->tid_req;
+    while (journal->committing) {
+        pthread_cond_wait(&journal->cond, &journal->lock);
+    }
+    if (!checkpoint && journal->tid_done >= ticket) {   // 已被其他线程的提交包含
+        pthread_mutex_unlock(&journal->lock);
+        return 0;
+    }
+    journal->committing = TRUE;
+    upto                = journal->tid_req;
+    pthread_mutex_unlock(&journal->lock);
+
+    // 此时没有进行中的操作，所有脏inode和位图写入块缓存后构成一个完整的快照
+    pthread_rwlock_wrlock(&journal->txn_lock);
+    inode_cnt = nfs_sync_inodes();
+    pthread_rwlock_unlock(&journal->txn_lock);
+
+    nfs_bcache_lock();
+    data_cnt = inode_cnt < 0 ? inode_cnt : nfs_bcache_sync_data();   // 元数据引用的数据块先落盘
+    log_cnt  = data_cnt < 0 ? data_cnt : nfs_journal_write_txn();
+    if (log_cnt >= 0 && checkpoint) {
+        ckpt_cnt = nfs_journal_checkpoint();
+    }
+    nfs_bcache_unlock();
+
+    pthread_mutex_lock(&journal->lock);
+    if (log_cnt >= 0 && ckpt_cnt >= 0) {
+        journal->tid_done = upto;
+    }
+    journal->committing = FALSE;
+    pthread_cond_broadcast(&journal->cond);
+    pthread_mutex_unlock(&journal->lock);
+
+    if (log_cnt < 0 || ckpt_cnt < 0) {
+        nfs_flush_error();
+        return -NFS_ERROR_IO;
+    }
+    return data_cnt + log_cnt + ckpt_cnt;
+}
+
+/**
+ * @brief 只提交一个文件: 把它的脏数据块写回原位置，再把它的inode槽、溢出extent块和它占用的位图位
+ * 作为一个事务写入日志，不写回其他inode；inode本身未修改(只覆盖写了已有数据块)时不写日志。
+ * 新建的inode(目录项尚未写回)和有未写回的释放时退回到整体提交
+ *
+ * @param inode 普通文件的inode
+ * @return int 写入设备的块数，失败返回错误码
+ */
+int nfs_journal_commit_inode(struct nfs_inode* inode) {
+    struct nfs_journal* journal = NFS_JOURNAL();
+    int                 ret = NFS_ERROR_NONE, data_cnt = 0, log_cnt = 0;
+    int                 dirty;
+
+    pthread_rwlock_rdlock(&inode->lock);
+    dirty = inode->dirty;
+    pthread_rwlock_unlock(&inode->lock);
+    if (dirty == 0) {
+        return 0;
+    }
+    if (dirty & NFS_INODE_DIRTY_NEW) {
+        return nfs_journal_commit(FALSE);
+    }
+
+    pthread_mutex_lock(&journal->lock);   // 与整体提交互斥，保证块缓存中的元数据块都属于本事务
+    while (journal->committing) {
+        pthread_cond_wait(&journal->cond, &journal->lock);
+    }
+    journal->committing = TRUE;
+    pthread_mutex_unlock(&journal->lock);
+
+    pthread_rwlock_wrlock(&inode->lock);
+    if (inode->dirty & NFS_INODE_DIRTY_META) {
+        ret = nfs_sync_inode_bits(inode);
+    }
+    if (ret == NFS_ERROR_NONE) {
+        ret = nfs_sync_inode(inode);   // inode槽和溢出extent块标记为元数据，文件数据为普通脏块
+    }
+    pthread_rwlock_unlock(&inode->lock);
+
+    if (ret == NFS_ERROR_NONE) {
+        nfs_bcache_lock();
+        data_cnt = nfs_bcache_sync_data();   // 只有刚写入块缓存的该文件数据块是普通脏块
+        log_cnt  = data_cnt < 0 ? data_cnt : nfs_journal_write_txn();
+        if (log_cnt >= 0) {
+            journal->file_commits++;
+        }
+        nfs_bcache_unlock();
+        ret = log_cnt < 0 ? -NFS_ERROR_IO : NFS_ERROR_NONE;
+    }
+
+    pthread_mutex_lock(&journal->lock);
+    journal->committing = FALSE;
+    pthread_cond_broadcast(&journal->cond);
+    pthread_mutex_unlock(&journal->lock);
+
+    if (ret == -NFS_ERROR_AGAIN) {
+        return nfs_journal_commit(FALSE);
+    }
+    if (ret != NFS_ERROR_NONE) {
+        nfs_flush_error();
+        return ret;
+    }
+    return data_cnt + log_cnt;
+}
+
+/**
+ * @brief 提交过程中未提交的元数据块达到一个事务的上限时调用: 先把已标记的元数据块作为一个事务写入日志，
+ * 腾出位置继续标记，调用者需持有块缓存锁并正在提交
+ * 一次提交因此拆成多个事务，每个事务各自原子；与数据块先于事务写回一样，拆分处掉电可能只重放前一部分
+ *
+ * @return int 0成功，否则返回对应错误号
+ */
+int nfs_journal_split() {
+    struct nfs_journal* journal = NFS_JOURNAL();
+    int                 data_cnt, log_cnt;
+
+    data_cnt = nfs_bcache_sync_data();   // 已标记的元数据引用的数据块先落盘
+    log_cnt  = data_cnt < 0 ? data_cnt : nfs_journal_write_txn();
+    if (log_cnt < 0) {
+        return -NFS_ERROR_IO;
+    }
+    journal->splits++;
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 释放数据块前调用，块在日志中仍有镜像时先做检查点
+ *
+ * @param blk 起始逻辑块号
+ * @param n 块数
+ */
+void nfs_journal_revoke(int blk, int n) {
+    struct nfs_journal* journal = NFS_JOURNAL();
+
+    nfs_bcache_lock();
+    for (int i = 0; i < journal->live_cnt; i++) {
+        if (journal->live[i] >= blk && journal->live[i] < blk + n) {
+            if (nfs_journal_checkpoint() < 0) {
+                NFS_DBG("[%s] checkpoint error\n", __func__);
+            }
+            break;
+        }
+    }
+    nfs_bcache_unlock();
+}
+
+/**
+ * @brief 日志是否有尚未检查点的事务
+ *
+ * @return boolean
+ */
+boolean nfs_journal_pending() {
+    boolean pending;
+    nfs_bcache_lock();
+    pending = NFS_JOURNAL()->head > 1;
+    nfs_bcache_unlock();
+    return pending;
+}
+
+/**
+ * @brief 卸载时释放日志，调用前需已做过检查点
+ */
+void nfs_journal_destroy() {
+    struct nfs_journal* journal = NFS_JOURNAL();
+
+    NFS_DBG("[%s] commits: %d (per-file: %d), journal blocks: %d, checkpoints: %d, splits: %d\n", __func__,
+            journal->commits, journal->file_commits, journal->logged, journal->checkpoints, journal->splits);
+    free(journal->live);
+    journal->live = NULL;
+    pthread_rwlock_destroy(&journal->txn_lock);
+    pthread_cond_destroy(&journal->cond);
+    pthread_mutex_destroy(&journal->lock);
+}
@@ -0,0 +1,620 @@
+#include "../include/nfs.h"
+#include "fuse_lowlevel.h"
+
+extern struct nfs_super      nfs_super;
+extern struct custom_options nfs_options;
+
+/*
+ * FUSE低层接口
+ * 高层接口的每个回调都带完整路径，每次操作都要从根目录逐层解析；低层接口的请求直接带inode号，
+ * 每个操作的开销与路径深度无关。
+ * 内核inode号为磁盘inode号加FUSE_ROOT_ID，根目录即FUSE_ROOT_ID。
+ * 内核每收到一次lookup/mknod/mkdir/create的回复就对该inode记一次lookup计数，直到forget归还，
+ * 期间可能随时用inode号发来请求。这些计数直接计入inode->ref，被内核引用的inode不会被inode缓存淘汰，
+ * 它的父目录也因为子目录项的inode仍在内存中而不会被淘汰(见nfs_icache_detach)，
+ * 因此nfs_super.ll_inodes中内核持有计数的inode号总是指向有效的inode。
+ * 内核释放目录项缓存时发送forget，之后这些inode才能被回收。
+ * 修改文件系统的操作在写回限流(nfs_flush_throttle)之后才回复，inode缓存的回收放在回复之后。
+ */
+
+#define NFS_LL_INO(ino)                 ((fuse_ino_t)(ino) - NFS_ROOT_INO + FUSE_ROOT_ID)   // 磁盘inode号 -> 内核inode号
+#define NFS_LL_INODE(ino)               NFS_LOAD(nfs_super.ll_inodes[(ino) - FUSE_ROOT_ID + NFS_ROOT_INO])
+#define NFS_LL_OPTION(t, p)             { t, offsetof(struct custom_options, p), 1 }
+#define NFS_LL_IOV_MAX                  160   // 读请求不超过128KB(libfuse 2.x的上限)，1KB的块最多跨越130个
+
+static const struct fuse_opt nfs_ll_opts[] = {   /* 高层接口中由libfuse解析的缓存有效期 */
+    NFS_LL_OPTION("entry_timeout=%lf", entry_timeout),
+    NFS_LL_OPTION("attr_timeout=%lf", attr_timeout),
+    NFS_LL_OPTION("negative_timeout=%lf", negative_timeout),
+    FUSE_OPT_END
+};
+
+static struct fuse_session* nfs_ll_session;
+
+/**
+ * @brief 填充inode的属性，内核inode号一并填入
+ *
+ * @param inode 被内核引用、句柄引用或持有日志读锁期间的inode
+ * @param st
+ */
+static void nfs_ll_stat(struct nfs_inode* inode, struct stat* st) {
+    nfs_epoch_enter();
+    nfs_fill_stat(inode->dentry, st);   // inode已被引用，仍挂在目录项上，不会读盘失败
+    nfs_epoch_exit();
+    st->st_ino = NFS_LL_INO(inode->ino);
+}
+
+/**
+ * @brief 为已增加过引用计数的inode登记inode号并填充回复内核的目录项
+ *
+ * @param inode
+ * @param e
+ */
+static void nfs_ll_entry(struct nfs_inode* inode, struct fuse_entry_param* e) {
+    NFS_STORE(nfs_super.ll_inodes[inode->ino], inode);   // 回复之前发布，内核之后用inode号找到它
+    memset(e, 0, sizeof(struct fuse_entry_param));
+    e->ino           = NFS_LL_INO(inode->ino);
+    e->entry_timeout = nfs_options.entry_timeout;
+    e->attr_timeout  = nfs_options.attr_timeout;
+    nfs_ll_stat(inode, &e->attr);
+}
+
+/**
+ * @brief 回复目录项，请求已被中断时内核不会记录这次lookup，归还对应的引用计数
+ *
+ * @param req
+ * @param e
+ * @param inode
+ */
+static void nfs_ll_reply_entry(fuse_req_t req, struct fuse_entry_param* e, struct nfs_inode* inode) {
+    if (fuse_reply_entry(req, e) != 0) {
+        nfs_inode_put(inode, 1);
+    }
+}
+
+/**
+ * @brief 回复错误号
+ *
+ * @param req
+ * @param ret 0或负的错误号
+ */
+static void nfs_ll_reply_err(fuse_req_t req, int ret) {
+    fuse_reply_err(req, -ret);
+}
+
+/**
+ * @brief 挂载文件系统，建立inode号索引，根目录常驻内存，不经lookup引用
+ *
+ * @param userdata
+ * @param conn 按挂载选项协商读写请求大小等参数
+ */
+static void nfs_ll_init(void* userdata, struct fuse_conn_info* conn) {
+    (void)userdata;
+    nfs_conn_setup(conn);
+    if (nfs_mount(nfs_options) != NFS_ERROR_NONE) {
+        NFS_DBG("[%s] mount error\n", __func__);
+        fuse_session_exit(nfs_ll_session);
+        return;
+    }
+    nfs_super.ll_inodes = (struct nfs_inode**)calloc(nfs_super.max_ino, sizeof(struct nfs_inode*));
+    if (nfs_super.ll_inodes == NULL) {
+        NFS_DBG("[%s] no memory for inode table\n", __func__);
+        fuse_session_exit(nfs_ll_session);
+        return;
+    }
+    nfs_super.ll_inodes[NFS_ROOT_INO] = nfs_super.root_dentry->inode;
+}
+
+/**
+ * @brief 卸载文件系统，内核不会为剩余的lookup计数发送forget，inode随整棵树一起释放
+ *
+ * @param userdata
+ */
+static void nfs_ll_destroy(void* userdata) {
+    (void)userdata;
+    if (nfs_umount() != NFS_ERROR_NONE) {
+        NFS_DBG("[%s] unmount error\n", __func__);
+    }
+    free(nfs_super.ll_inodes);
+    nfs_super.ll_inodes = NULL;
+}
+
+/**
+ * @brief 在目录中查找文件名，找到时增加其inode的引用计数(内核的lookup计数)
+ *
+ * @param req
+ * @param parent 目录的inode号
+ * @param name 文件名
+ */
+static void nfs_ll_lookup(fuse_req_t req, fuse_ino_t parent, const char* name) {
+    struct nfs_inode*       dir = NFS_LL_INODE(parent);
+    struct nfs_dentry*      dentry;
+    struct nfs_inode*       inode;
+    struct fuse_entry_param e;
+
+    if (!NFS_IS_DIR(dir)) {
+        nfs_ll_reply_err(req, -NFS_ERROR_NOTDIR);
+        return;
+    }
+    if (strlen(name) > MAX_NAME_LEN) {   // 不截断后与已有的文件名混淆
+        nfs_ll_reply_err(req, -NFS_ERROR_NAMETOOLONG);
+        return;
+    }
+    nfs_epoch_enter();   // 哈希索引与创建并发时被替换的旧表不会被释放
+    dentry = nfs_dir_lookup(dir, name);
+    if (dentry == NULL) {
+        nfs_epoch_exit();
+        if (nfs_options.negative_timeout > 0) {   // inode号为0的目录项表示不存在，内核缓存这一结果
+            memset(&e, 0, sizeof(struct fuse_entry_param));
+            e.entry_timeout = nfs_options.negative_timeout;
+            fuse_reply_entry(req, &e);
+        }
+        else {
+            nfs_ll_reply_err(req, -NFS_ERROR_NOTFOUND);
+        }
+        return;
+    }
+    // 目录被内核引用，它的目录项不会被回收，只有目录项的inode可能在读入之后、加引用之前被淘汰
+    do {
+        inode = nfs_inode_get(dentry);
+    } while (inode == (struct nfs_inode*)-NFS_ERROR_AGAIN);
+    nfs_epoch_exit();
+    if (inode == NULL) {
+        nfs_ll_reply_err(req, -NFS_ERROR_IO);
+        return;
+    }
+    nfs_ll_entry(inode, &e);
+    nfs_ll_reply_entry(req, &e, inode);
+    nfs_icache_balance();
+}
+
+/**
+ * @brief 内核归还lookup计数，根目录不计数
+ *
+ * @param ino
+ * @param nlookup 归还的计数
+ */
+static void nfs_ll_forget_one(fuse_ino_t ino, unsigned long nlookup) {
+    if (ino != FUSE_ROOT_ID) {
+        nfs_inode_put(NFS_LL_INODE(ino), (int)nlookup);
+    }
+}
+
+static void nfs_ll_forget(fuse_req_t req, fuse_ino_t ino, unsigned long nlookup) {
+    nfs_ll_forget_one(ino, nlookup);
+    fuse_reply_none(req);
+    nfs_icache_balance();   // 不再被内核引用的inode现在可以淘汰
+}
+
+#if FUSE_VERSION >= 29
+static void nfs_ll_forget_multi(fuse_req_t req, size_t count, struct fuse_forget_data* forgets) {
+    for (size_t i = 0; i < count; i++) {
+        nfs_ll_forget_one(forgets[i].ino, forgets[i].nlookup);
+    }
+    fuse_reply_none(req);
+    nfs_icache_balance();
+}
+#endif
+
+/**
+ * @brief 获取文件或目录的属性
+ *
+ * @param req
+ * @param ino
+ * @param fi 可忽略
+ */
+static void nfs_ll_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+    struct stat st;
+
+    (void)fi;
+    nfs_ll_stat(NFS_LL_INODE(ino), &st);
+    fuse_reply_attr(req, &st, nfs_options.attr_timeout);
+}
+
+/**
+ * @brief 修改属性，支持改变文件大小(truncate)和访问/修改时间(utimens)，与高层接口一样不支持修改权限和属主
+ *
+ * @param req
+ * @param ino
+ * @param attr 新的属性
+ * @param to_set FUSE_SET_ATTR_*，指出attr中哪些字段有效
+ * @param fi 可忽略
+ */
+static void nfs_ll_setattr(fuse_req_t req, fuse_ino_t ino, struct stat* attr, int to_set,
+                           struct fuse_file_info* fi) {
+    struct nfs_inode* inode = NFS_LL_INODE(ino);
+    struct timespec   tv[2] = { { 0, UTIME_OMIT }, { 0, UTIME_OMIT } };
+    struct stat       st;
+    int               ret   = NFS_ERROR_NONE;
+
+    (void)fi;
+    if (to_set & (FUSE_SET_ATTR_MODE | FUSE_SET_ATTR_UID | FUSE_SET_ATTR_GID)) {
+        nfs_ll_reply_err(req, -NFS_ERROR_NOSYS);
+        return;
+    }
+    if ((to_set & FUSE_SET_ATTR_SIZE) && NFS_IS_DIR(inode)) {
+        nfs_ll_reply_err(req, -NFS_ERROR_ISDIR);
+        return;
+    }
+    if (to_set & FUSE_SET_ATTR_ATIME) {
+        tv[0] = attr->st_atim;
+    }
+    if (to_set & FUSE_SET_ATTR_MTIME) {
+        tv[1] = attr->st_mtim;
+    }
+#ifdef FUSE_SET_ATTR_ATIME_NOW
+    if (to_set & FUSE_SET_ATTR_ATIME_NOW) {
+        tv[0].tv_nsec = UTIME_NOW;
+    }
+    if (to_set & FUSE_SET_ATTR_MTIME_NOW) {
+        tv[1].tv_nsec = UTIME_NOW;
+    }
+#endif
+
+    nfs_journal_begin();
+    pthread_rwlock_wrlock(&inode->lock);
+    if (to_set & FUSE_SET_ATTR_SIZE) {
+        ret = attr->st_size > INT_MAX ? -NFS_ERROR_FBIG : nfs_inode_truncate(inode, attr->st_size);
+    }
+    if (ret == NFS_ERROR_NONE && (tv[0].tv_nsec != UTIME_OMIT || tv[1].tv_nsec != UTIME_OMIT)) {
+        nfs_inode_utimens(inode, tv);
+    }
+    pthread_rwlock_unlock(&inode->lock);
+    nfs_journal_end();
+    nfs_flush_throttle();
+    if (ret < 0) {
+        nfs_ll_reply_err(req, ret);
+    }
+    else {
+        nfs_ll_stat(inode, &st);
+        fuse_reply_attr(req, &st, nfs_options.attr_timeout);
+    }
+    nfs_icache_balance();
+}
+
+/**
+ * @brief 为目录或文件创建句柄并回复，句柄持有inode引用计数
+ *
+ * @param req
+ * @param inode
+ * @param fi
+ * @param is_dir 是否由opendir调用
+ */
+static void nfs_ll_open_fh(fuse_req_t req, struct nfs_inode* inode, struct fuse_file_info* fi, boolean is_dir) {
+    struct nfs_fhandle* fh;
+
+    if (NFS_IS_DIR(inode) != is_dir) {
+        nfs_ll_reply_err(req, is_dir ? -NFS_ERROR_NOTDIR : -NFS_ERROR_ISDIR);
+        return;
+    }
+    nfs_epoch_enter();
+    fh = nfs_fhandle_get(inode->dentry);   // inode被内核引用，不会返回-NFS_ERROR_AGAIN
+    if (fh != NULL && is_dir) {   // 子目录项的inode表块交给预读线程，readdir之后的lookup不必逐个读盘
+        nfs_prefetch_inodes(inode, TRUE);
+    }
+    nfs_epoch_exit();
+    if (fh == NULL) {
+        nfs_ll_reply_err(req, -NFS_ERROR_NOMEM);
+        return;
+    }
+    fi->fh         = (uint64_t)(uintptr_t)fh;
+    fi->keep_cache = !is_dir;   // 文件只会经本文件系统修改，打开时不必丢弃内核页缓存
+    if (fuse_reply_open(req, fi) != 0) {   // 请求已被中断，不会有对应的release
+        nfs_fhandle_put(fh);
+    }
+}
+
+/**
+ * @brief 在目录下新建文件或目录，fi不为NULL时(create)同时打开
+ *
+ * @param req
+ * @param parent 目录的inode号
+ * @param name 文件名
+ * @param ftype 文件类型
+ * @param fi create的文件信息，mknod/mkdir为NULL
+ */
+static void nfs_ll_new(fuse_req_t req, fuse_ino_t parent, const char* name, NFS_FILE_TYPE ftype,
+                       struct fuse_file_info* fi) {
+    struct nfs_dentry*      dentry;
+    struct nfs_inode*       inode;
+    struct nfs_fhandle*     fh = NULL;
+    struct fuse_entry_param e;
+    int                     ret;
+
+    if (strlen(name) > MAX_NAME_LEN) {   // 不截断文件名，也不为此开启事务
+        nfs_ll_reply_err(req, -NFS_ERROR_NAMETOOLONG);
+        return;
+    }
+    nfs_journal_begin();
+    ret = nfs_create(NFS_LL_INODE(parent), name, ftype, &dentry);
+    if (ret < 0) {
+        nfs_journal_end();
+        nfs_ll_reply_err(req, ret);
+        return;
+    }
+    inode = nfs_inode_get(dentry);   // 持有日志读锁，新建的inode不会被淘汰
+    if (fi != NULL && (fh = nfs_fhandle_get(dentry)) == NULL) {
+        nfs_inode_put(inode, 1);
+        nfs_journal_end();
+        nfs_ll_reply_err(req, -NFS_ERROR_NOMEM);
+        return;
+    }
+    nfs_ll_entry(inode, &e);
+    nfs_journal_end();
+    nfs_flush_throttle();   // 脏数据过多时等待写回，此时已不持有任何inode锁
+
+    if (fi == NULL) {
+        nfs_ll_reply_entry(req, &e, inode);
+    }
+    else {
+        fi->fh         = (uint64_t)(uintptr_t)fh;
+        fi->keep_cache = 1;
+        if (fuse_reply_create(req, &e, fi) != 0) {
+            nfs_fhandle_put(fh);
+            nfs_inode_put(inode, 1);
+        }
+    }
+    nfs_icache_balance();
+}
+
+static void nfs_ll_mknod(fuse_req_t req, fuse_ino_t parent, const char* name, mode_t mode, dev_t rdev) {
+    (void)rdev;
+    nfs_ll_new(req, parent, name, S_ISDIR(mode) ? NFS_DIR : NFS_REG_FILE, NULL);
+}
+
+static void nfs_ll_mkdir(fuse_req_t req, fuse_ino_t parent, const char* name, mode_t mode) {
+    (void)mode;
+    nfs_ll_new(req, parent, name, NFS_DIR, NULL);
+}
+
+static void nfs_ll_create(fuse_req_t req, fuse_ino_t parent, const char* name, mode_t mode,
+                          struct fuse_file_info* fi) {
+    (void)mode;
+    nfs_ll_new(req, parent, name, NFS_REG_FILE, fi);
+}
+
+static void nfs_ll_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+    nfs_ll_open_fh(req, NFS_LL_INODE(ino), fi, FALSE);
+}
+
+static void nfs_ll_opendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+    nfs_ll_open_fh(req, NFS_LL_INODE(ino), fi, TRUE);
+}
+
+/**
+ * @brief 读取文件，经句柄直接访问inode，回复直接引用inode的数据块，不经中间缓冲区复制
+ *
+ * @param req
+ * @param ino
+ * @param size 读取的字节数
+ * @param off 相对文件的偏移
+ * @param fi fi->fh为open时保存的句柄
+ */
+static void nfs_ll_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info* fi) {
+    struct nfs_inode* inode = NFS_FH(fi)->inode;
+    struct iovec      iov_buf[NFS_LL_IOV_MAX];
+    struct iovec*     iov = iov_buf;
+    int               cnt = size / NFS_BLKS_SZ(1) + 2;
+    int               ret;
+
+    (void)ino;
+    if (cnt > NFS_LL_IOV_MAX && (iov = (struct iovec*)malloc(cnt * sizeof(struct iovec))) == NULL) {   // 只有超出协商上限的请求才会分配
+        nfs_ll_reply_err(req, -NFS_ERROR_NOMEM);
+        return;
+    }
+    pthread_rwlock_rdlock(&inode->lock);   // 回复完成之前数据块不能被丢弃或替换
+    ret = nfs_inode_read_iov(inode, NFS_FH(fi), iov, size, off);
+    if (ret < 0) {
+        nfs_ll_reply_err(req, ret);
+    }
+    else {
+        fuse_reply_iov(req, iov, ret);
+    }
+    pthread_rwlock_unlock(&inode->lock);
+    if (iov != iov_buf) {
+        free(iov);
+    }
+    nfs_icache_balance();
+}
+
+/**
+ * @brief 写入文件，经句柄直接访问inode
+ *
+ * @param req
+ * @param ino
+ * @param buf 写入的内容
+ * @param size 写入的字节数
+ * @param off 相对文件的偏移
+ * @param fi fi->fh为open时保存的句柄
+ */
+static void nfs_ll_write(fuse_req_t req, fuse_ino_t ino, const char* buf, size_t size, off_t off,
+                         struct fuse_file_info* fi) {
+    struct nfs_inode* inode = NFS_FH(fi)->inode;
+    int               ret;
+
+    (void)ino;
+    nfs_journal_begin();
+    pthread_rwlock_wrlock(&inode->lock);
+    ret = nfs_inode_write(inode, buf, size, off);
+    pthread_rwlock_unlock(&inode->lock);
+    nfs_journal_end();
+    nfs_flush_throttle();
+    if (ret < 0) {
+        nfs_ll_reply_err(req, ret);
+    }
+    else {
+        fuse_reply_write(req, ret);
+    }
+    nfs_icache_balance();
+}
+
+/**
+ * @brief 每次close时调用，不写回，只报告此前的写回失败，见nfs_flush
+ */
+static void nfs_ll_flush(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+    (void)ino;
+    nfs_ll_reply_err(req, nfs_flush_check(NFS_FH(fi)));
+}
+
+/**
+ * @brief 持久化文件，datasync的含义见nfs_fsync
+ */
+static void nfs_ll_fsync(fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info* fi) {
+    int ret;
+
+    (void)ino;
+    (void)datasync;
+    ret = nfs_journal_commit_inode(NFS_FH(fi)->inode);
+    if (nfs_flush_check(NFS_FH(fi)) < 0) {   // 本次提交或此前的后台写回失败
+        ret = -NFS_ERROR_IO;
+    }
+    nfs_ll_reply_err(req, ret < 0 ? -NFS_ERROR_IO : NFS_ERROR_NONE);
+}
+
+/**
+ * @brief 关闭文件，写回该文件并释放open时分配的句柄，见nfs_release
+ */
+static void nfs_ll_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+    (void)ino;
+    nfs_journal_commit_inode(NFS_FH(fi)->inode);
+    nfs_fhandle_put(NFS_FH(fi));
+    fi->fh = 0;
+    nfs_ll_reply_err(req, NFS_ERROR_NONE);
+}
+
+/**
+ * @brief 遍历目录项，从句柄记录的游标处继续填充，只用到目录项中的inode号和类型，不必读入子目录项的inode
+ *
+ * @param req
+ * @param ino
+ * @param size buf的大小
+ * @param off 第几个目录项
+ * @param fi fi->fh为opendir时保存的句柄
+ */
+static void nfs_ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+                           struct fuse_file_info* fi) {
+    struct nfs_fhandle* fh = NFS_FH(fi);
+    struct nfs_dentry*  sub_dentry;
+    struct stat         sub_stat;
+    char*               buf;
+    size_t              used = 0;
+    size_t              len;
+
+    (void)ino;
+    buf = (char*)malloc(size);
+    if (buf == NULL) {
+        nfs_ll_reply_err(req, -NFS_ERROR_NOMEM);
+        return;
+    }
+    memset(&sub_stat, 0, sizeof(struct stat));
+
+    nfs_epoch_enter();
+    if (fh->pos == off) {   // 游标失效时才从头定位第off个目录项
+        sub_dentry = fh->next;
+    }
+    else {
+        sub_dentry = nfs_get_dentry(fh->inode, off);
+    }
+    while (sub_dentry) {
+        sub_stat.st_ino  = NFS_LL_INO(sub_dentry->ino);
+        sub_stat.st_mode = sub_dentry->ftype == NFS_DIR ? S_IFDIR : S_IFREG;
+        len = fuse_add_direntry(req, buf + used, size - used, sub_dentry->name, &sub_stat, off + 1);
+        if (len > size - used) {   // buf已满
+            break;
+        }
+        used += len;
+        off++;
+        sub_dentry = NFS_LOAD(sub_dentry->brother);
+    }
+    nfs_epoch_exit();
+
+    fh->pos  = off;
+    fh->next = sub_dentry;
+    fuse_reply_buf(req, buf, used);
+    free(buf);
+    nfs_icache_balance();
+}
+
+static void nfs_ll_releasedir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+    (void)ino;
+    nfs_fhandle_put(NFS_FH(fi));
+    fi->fh = 0;
+    nfs_ll_reply_err(req, NFS_ERROR_NONE);
+}
+
+/**
+ * @brief 持久化目录，提交此前的所有操作
+ */
+static void nfs_ll_fsyncdir(fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info* fi) {
+    (void)ino;
+    (void)datasync;
+    (void)fi;
+    nfs_ll_reply_err(req, nfs_journal_commit(FALSE) < 0 ? -NFS_ERROR_IO : NFS_ERROR_NONE);
+}
+
+static const struct fuse_lowlevel_ops nfs_ll_ops = {
+    .init        = nfs_ll_init,
+    .destroy     = nfs_ll_destroy,
+    .lookup      = nfs_ll_lookup,
+    .forget      = nfs_ll_forget,
+#if FUSE_VERSION >= 29
+    .forget_multi = nfs_ll_forget_multi,
+#endif
+    .getattr     = nfs_ll_getattr,
+    .setattr     = nfs_ll_setattr,
+    .mknod       = nfs_ll_mknod,
+    .mkdir       = nfs_ll_mkdir,
+    .create      = nfs_ll_create,
+    .open        = nfs_ll_open,
+    .read        = nfs_ll_read,
+    .write       = nfs_ll_write,
+    .flush       = nfs_ll_flush,
+    .release     = nfs_ll_release,
+    .fsync       = nfs_ll_fsync,
+    .opendir     = nfs_ll_opendir,
+    .readdir     = nfs_ll_readdir,
+    .releasedir  = nfs_ll_releasedir,
+    .fsyncdir    = nfs_ll_fsyncdir,
+};
+
+/**
+ * @brief 以低层接口挂载并处理请求直到卸载，相当于高层接口的fuse_main
+ * -o entry_timeout/attr_timeout/negative_timeout由这里解析，前两者默认为--cache_timeout
+ *
+ * @param args 已解析过自定义选项的命令行参数
+ * @return int 0成功，否则返回1
+ */
+int nfs_ll_main(struct fuse_args* args) {
+    struct fuse_chan* ch;
+    char*             mountpoint;
+    int               multithreaded, foreground;
+    int               ret = -1;
+
+    nfs_options.entry_timeout    = nfs_options.cache_timeout > 0 ? nfs_options.cache_timeout : 1.0;   // 0时与libfuse的默认值相同
+    nfs_options.attr_timeout     = nfs_options.entry_timeout;
+    nfs_options.negative_timeout = 0;
+    if (fuse_opt_parse(args, &nfs_options, nfs_ll_opts, NULL) == -1
+        || fuse_parse_cmdline(args, &mountpoint, &multithreaded, &foreground) == -1) {
+        return 1;
+    }
+    ch = fuse_mount(mountpoint, args);
+    if (ch == NULL) {
+        free(mountpoint);
+        return 1;
+    }
+    nfs_ll_session = fuse_lowlevel_new(args, &nfs_ll_ops, sizeof(nfs_ll_ops), NULL);
+    if (nfs_ll_session != NULL) {
+        if (fuse_set_signal_handlers(nfs_ll_session) != -1) {
+            fuse_session_add_chan(nfs_ll_session, ch);
+            if (fuse_daemonize(foreground) != -1) {
+                ret = multithreaded ? fuse_session_loop_mt(nfs_ll_session) : fuse_session_loop(nfs_ll_session);
+            }
+            fuse_remove_signal_handlers(nfs_ll_session);
+            fuse_session_remove_chan(ch);
+        }
+        fuse_session_destroy(nfs_ll_session);
+    }
+    fuse_unmount(mountpoint, ch);
+    free(mountpoint);
+    return ret == 0 ? 0 : 1;
+}
@@ -0,0 +1,247 @@
+#include "../include/nfs.h"
+
+extern struct nfs_super      nfs_super;
+
+#define NFS_RA()                        (&nfs_super.ra)
+
+/*
+ * 顺序读预读
+ * 每个打开文件的句柄记录下一次顺序读的位置和当前的预读窗口:
+ *   1. 读请求紧接着上一次读取(或从文件头开始)时视为顺序读，窗口从本次请求的大小(至少NFS_READAHEAD_MIN)
+ *      开始每次翻倍，直到上限；否则视为随机读，窗口收缩为0，不再预读
+ *   2. 本次请求中尚未读入内存的块同步读入块缓存，设备上连续的块只寻道一次
+ *   3. 已提交预读的范围在本次读取之后剩余不足半个窗口时，把之后一个窗口的块交给预读线程异步读入块缓存，
+ *      读者处理数据的同时预读线程读盘，之后读到这些块时直接从块缓存复制
+ * 队列中只有设备逻辑块的范围，不引用inode；块缓存与设备内容一致，预读到刚被释放或重新分配的块也不会读到过时的数据
+ */
+
+/**
+ * @brief 预读线程，依次取出队列中的请求读入块缓存
+ *
+ * @param arg
+ * @return void*
+ */
+static void* nfs_readahead_worker(void* arg) {
+    struct nfs_readahead* ra = NFS_RA();
+    int                   blk, cnt;
+
+    pthread_mutex_lock(&ra->lock);
+    while (!ra->stop) {
+        if (ra->head == ra->tail) {
+            pthread_cond_wait(&ra->cond, &ra->lock);
+            continue;
+        }
+        blk = ra->blk[ra->head % NFS_READAHEAD_QUEUE];
+        cnt = ra->cnt[ra->head % NFS_READAHEAD_QUEUE];
+        ra->head++;
+        pthread_mutex_unlock(&ra->lock);
+
+        nfs_bcache_prefetch(blk, cnt);   // 已在块缓存中的块会被跳过
+
+        pthread_mutex_lock(&ra->lock);
+    }
+    pthread_mutex_unlock(&ra->lock);
+    return NULL;
+}
+
+/**
+ * @brief 设置预读窗口上限并启动预读线程，在挂载完成后调用
+ *
+ * @param max_kb 预读窗口上限(KB)，0表示不预读
+ * @return int
+ */
+int nfs_readahead_start(int max_kb) {
+    struct nfs_readahead* ra = NFS_RA();
+
+    ra->max_win = max_kb * 1024 / NFS_BLKS_SZ(1);
+    if (ra->max_win > NFS_BUF_NUM / 2) {   // 预读的块不能挤掉块缓存中的其他内容
+        ra->max_win = NFS_BUF_NUM / 2;
+    }
+    ra->head   = 0;
+    ra->tail   = 0;
+    ra->on     = FALSE;
+    ra->stop   = FALSE;
+    ra->submit = 0;
+    ra->drop   = 0;
+    pthread_mutex_init(&ra->lock, NULL);
+    pthread_cond_init(&ra->cond, NULL);
+
+    if (ra->max_win <= 0) {
+        return NFS_ERROR_NONE;
+    }
+    if (pthread_create(&ra->thread, NULL, nfs_readahead_worker, NULL) != 0) {
+        NFS_DBG("[%s] create readahead thread failed, read ahead synchronously\n", __func__);
+        return NFS_ERROR_NONE;
+    }
+    ra->on = TRUE;
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 停止预读线程，队列中尚未处理的请求直接丢弃
+ */
+void nfs_readahead_stop() {
+    struct nfs_readahead* ra = NFS_RA();
+
+    pthread_mutex_lock(&ra->lock);
+    ra->stop = TRUE;
+    pthread_cond_signal(&ra->cond);
+    pthread_mutex_unlock(&ra->lock);
+    if (ra->on) {
+        pthread_join(ra->thread, NULL);
+        ra->on = FALSE;
+    }
+    NFS_DBG("[%s] window: %dKB, submit: %d, drop: %d\n", __func__,
+            ra->max_win * NFS_BLKS_SZ(1) / 1024, ra->submit, ra->drop);
+    pthread_cond_destroy(&ra->cond);
+    pthread_mutex_destroy(&ra->lock);
+}
+
+/**
+ * @brief 把[blk, blk + n)交给预读线程读入块缓存，不等待；预读线程没有运行时同步读入
+ *
+ * @param blk 起始逻辑块号
+ * @param n 逻辑块数量，不超过NFS_BUF_NUM / 2
+ */
+void nfs_readahead_submit(int blk, int n) {
+    struct nfs_readahead* ra = NFS_RA();
+    int                   last;
+
+    if (n <= 0) {
+        return;
+    }
+    if (!ra->on) {
+        nfs_bcache_prefetch(blk, n);
+        return;
+    }
+    pthread_mutex_lock(&ra->lock);
+    last = (ra->tail - 1) % NFS_READAHEAD_QUEUE;
+    if (ra->tail > ra->head && ra->blk[last] + ra->cnt[last] == blk
+        && ra->cnt[last] + n <= NFS_BUF_NUM / 2) {   // 与队尾尚未取出的请求相接，合并为一次寻道
+        ra->cnt[last] += n;
+    }
+    else if (ra->tail - ra->head < NFS_READAHEAD_QUEUE) {
+        ra->blk[ra->tail % NFS_READAHEAD_QUEUE] = blk;
+        ra->cnt[ra->tail % NFS_READAHEAD_QUEUE] = n;
+        ra->tail++;
+        ra->submit++;
+        pthread_cond_signal(&ra->cond);
+    }
+    else {   // 预读只是提示，队列满时丢弃，之后读到这些块时再同步读入
+        ra->drop++;
+    }
+    pthread_mutex_unlock(&ra->lock);
+}
+
+/**
+ * @brief 读入设备上的一段连续块
+ *
+ * @param blk 起始逻辑块号
+ * @param n 逻辑块数量
+ * @param async 是否交给预读线程
+ */
+static void nfs_readahead_issue(int blk, int n, boolean async) {
+    if (n <= 0) {
+        return;
+    }
+    if (async) {
+        nfs_readahead_submit(blk, n);
+    }
+    else {
+        nfs_bcache_prefetch(blk, n);
+    }
+}
+
+/**
+ * @brief 把普通文件[from, to)中尚未读入内存的块按设备上的连续段读入块缓存，调用者需持有inode读锁
+ *
+ * @param inode 普通文件的inode
+ * @param from 起始块(文件内逻辑块号)
+ * @param to 结束块(不含)，不超过block_num
+ * @param async 是否交给预读线程
+ */
+static void nfs_readahead_blocks(struct nfs_inode* inode, int from, int to, boolean async) {
+    struct nfs_extent* ext;
+    int                base = 0;   // 当前extent第一个块的文件内逻辑块号
+    int                start = -1, len = 0;   // 尚未读入的一段连续设备块
+    int                dev;
+
+    for (int i = 0; i < inode->extent_num && base < to; i++) {
+        ext = &inode->extents[i];
+        for (int b = base > from ? base : from; b < base + ext->len && b < to; b++) {
+            if (NFS_LOAD(inode->block_pointer[b]) != NULL) {   // 已在内存中，不必读盘
+                nfs_readahead_issue(start, len, async);
+                len = 0;
+                continue;
+            }
+            dev = NFS_DATA_BLK(ext->start + b - base);
+            if (len > 0 && start + len == dev && len < NFS_BUF_NUM / 2) {
+                len++;
+            }
+            else {
+                nfs_readahead_issue(start, len, async);
+                start = dev;
+                len   = 1;
+            }
+        }
+        base += ext->len;
+    }
+    nfs_readahead_issue(start, len, async);
+}
+
+/**
+ * @brief 读取普通文件的[offset, offset + size)之前调用: 同步读入本次需要的块，顺序读时异步预读之后的块
+ * 调用者需持有inode读锁
+ *
+ * @param inode 普通文件的inode
+ * @param fh 打开文件的句柄，NULL时只读入本次需要的块
+ * @param offset 相对文件的偏移
+ * @param size 读取的字节数，已截断到文件末尾
+ */
+void nfs_readahead(struct nfs_inode* inode, struct nfs_fhandle* fh, off_t offset, size_t size) {
+    struct nfs_readahead* ra    = NFS_RA();
+    int                   first = offset / NFS_BLKS_SZ(1);
+    int                   end   = (offset + size + NFS_BLKS_SZ(1) - 1) / NFS_BLKS_SZ(1);   // 本次读取的最后一块之后
+    int                   next, win, ra_end;
+
+    if (NFS_IS_INLINE(inode) || size == 0) {
+        return;
+    }
+    if (end > inode->block_num) {
+        end = inode->block_num;
+    }
+    nfs_readahead_blocks(inode, first, end, FALSE);
+    if (fh == NULL || ra->max_win == 0) {
+        return;
+    }
+
+    // 同一句柄可能被并发读取，预读状态只是启发式的，各字段单独读写
+    next   = NFS_LOAD(fh->ra_next);
+    win    = NFS_LOAD(fh->ra_win);
+    ra_end = NFS_LOAD(fh->ra_end);
+    if (first == next) {   // 从上次结束之后的块继续读，窗口翻倍
+        win = win > 0 ? win * 2 : (end - first > NFS_READAHEAD_MIN ? end - first : NFS_READAHEAD_MIN);
+        win = win < ra->max_win ? win : ra->max_win;
+    }
+    else if (first != next - 1) {   // 不是从上次结束的块继续读(小于一块的顺序读)，视为随机读
+        win    = 0;
+        ra_end = 0;
+    }
+    NFS_STORE(fh->ra_next, end);
+    NFS_STORE(fh->ra_win, win);
+    if (win == 0) {
+        NFS_STORE(fh->ra_end, 0);
+        return;
+    }
+    if (ra_end < end) {
+        ra_end = end;
+    }
+    if (ra_end - end >= win / 2 || ra_end >= inode->block_num) {   // 已预读的部分还够读，或已到文件末尾
+        return;
+    }
+    next = end + win < inode->block_num ? end + win : inode->block_num;
+    if (next > ra_end) {
+        nfs_readahead_blocks(inode, ra_end, next, TRUE);
+        NFS_STORE(fh->ra_end, next);
+    }
+}
@@ -40,7 +40,7 @@ int nfs_calc_lvl(const char * path) {
 }
 
 /**
- * @brief 驱动读
+ * @brief 驱动读，经过块缓存，只有未命中的逻辑块才会访问磁盘
  * 
  * @param offset：要读取的数据段在磁盘中的偏移 
  * @param out_content：存放读取出的内容 
@@ -48,30 +48,32 @@ int nfs_calc_lvl(const char * path) {
  * @return int 
  */
 int nfs_driver_read(int offset, uint8_t *out_content, int size) {
-    int      offset_aligned = NFS_ROUND_DOWN(offset, NFS_BLKS_SZ(1));   // 偏移所在的磁盘块的起始地址
-    int      bias           = offset - offset_aligned;   // 偏移量和数据块对齐后的偏移量的差
-    int      size_aligned   = NFS_ROUND_UP((size + bias), NFS_BLKS_SZ(1));   // 读取内容需要访问数据块的大小(需访问的磁盘块数量*每个磁盘块大小)
-    uint8_t* temp_content   = (uint8_t*)malloc(size_aligned);
-    uint8_t* cur            = temp_content;
-    // lseek(SFS_DRIVER(), offset_aligned, SEEK_SET);
-    // 移动磁盘头到下界down的位置
-    ddriver_seek(NFS_DRIVER(), offset_aligned, SEEK_SET);
-    // 将需要访问磁盘块的内容全部读取到cur中
-    while (size_aligned != 0)
+    struct nfs_buf* buf;
+    int             blk  = NFS_BLK_NO(offset);   // 偏移所在的逻辑块号
+    int             bias = offset - NFS_BLKS_SZ(blk);   // 偏移量在逻辑块内的偏移
+    int             len;
+    // 逐个逻辑块从缓存中拷贝出需要的部分，拷贝期间持有块缓存锁防止缓冲区被淘汰
+    nfs_bcache_lock();
+    while (size > 0)
     {
-        // 每次读取一个IO大小
-        // read(SFS_DRIVER(), cur, SFS_IO_SZ());
-        ddriver_read(NFS_DRIVER(), (char*)cur, NFS_IO_SZ());
-        cur          += NFS_IO_SZ();
-        size_aligned -= NFS_IO_SZ();   
-    }
-    memcpy(out_content, temp_content + bias, size);
-    free(temp_content);
+        len = NFS_BLKS_SZ(1) - bias < size ? NFS_BLKS_SZ(1) - bias : size;
+        buf = nfs_bread(blk);
+        if (buf == NULL) {
+            nfs_bcache_unlock();
+            return -NFS_ERROR_IO;
+        }
+        memcpy(out_content, buf->data + bias, len);
+        out_content += len;
+        size        -= len;
+        bias         = 0;
+        blk++;
+    }
+    nfs_bcache_unlock();
     return NFS_ERROR_NONE;
 }
 
 /**
- * @brief 驱动写
+ * @brief 驱动写，只修改块缓存并标记为脏，sync或被淘汰时才写回磁盘
  * 
  * @param offset：要写回的目标地址 
  * @param in_content：待写回的内容 
@@ -79,89 +81,333 @@ int nfs_driver_read(int offset, uint8_t *out_content, int size) {
  * @return int 
  */
 int nfs_driver_write(int offset, uint8_t *in_content, int size) {
-    int      offset_aligned = NFS_ROUND_DOWN(offset, NFS_BLKS_SZ(1));   // 偏移所在的磁盘块的起始地址
-    int      bias           = offset - offset_aligned;   //偏移量和数据块对齐后的偏移量的差
-    int      size_aligned   = NFS_ROUND_UP((size + bias), NFS_BLKS_SZ(1));   // 写回内容需要访问数据块的大小(需访问的磁盘块数量*每个磁盘块大小)
-    uint8_t* temp_content   = (uint8_t*)malloc(size_aligned);
-    uint8_t* cur            = temp_content;
-    nfs_driver_read(offset_aligned, temp_content, size_aligned);   // 先把磁盘块所有内容读出
-    memcpy(temp_content + bias, in_content, size);   // 用写回的数据替换磁盘块中对应位置的内容
-    
-    // lseek(SFS_DRIVER(), offset_aligned, SEEK_SET);
-    // 移动磁盘头到下界down的位置
-    ddriver_seek(NFS_DRIVER(), offset_aligned, SEEK_SET);
-    // 将读取出的数据写回磁盘块中，每次写回一个IO的大小
-    while (size_aligned != 0)
+    struct nfs_buf* buf;
+    int             blk  = NFS_BLK_NO(offset);   // 偏移所在的逻辑块号
+    int             bias = offset - NFS_BLKS_SZ(blk);   // 偏移量在逻辑块内的偏移
+    int             len;
+    // 逐个逻辑块修改缓存，整块覆盖时无需先读出原内容
+    nfs_bcache_lock();
+    while (size > 0)
     {
-        // write(SFS_DRIVER(), cur, SFS_IO_SZ());
-        ddriver_write(NFS_DRIVER(), (char*)cur, NFS_IO_SZ());
-        cur          += NFS_IO_SZ();
-        size_aligned -= NFS_IO_SZ();   
+        len = NFS_BLKS_SZ(1) - bias < size ? NFS_BLKS_SZ(1) - bias : size;
+        buf = (len == NFS_BLKS_SZ(1)) ? nfs_bget(blk) : nfs_bread(blk);
+        if (buf == NULL) {
+            nfs_bcache_unlock();
+            return -NFS_ERROR_IO;
+        }
+        memcpy(buf->data + bias, in_content, len);
+        nfs_bdirty(buf);
+        in_content += len;
+        size       -= len;
+        bias        = 0;
+        blk++;
+    }
+    nfs_bcache_unlock();
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 把块缓存中的逻辑块标记为本次提交的元数据，一个事务放不下时先提交已标记的部分，调用者需持有块缓存锁
+ * 必须在修改缓冲区之前调用，否则提前提交时写回数据块会把修改了一半的元数据块直接写回原位置
+ * 
+ * @param blk 逻辑块号
+ * @return int 
+ */
+static int nfs_mark_meta(int blk) {
+    if (nfs_bmeta(blk) != -NFS_ERROR_NOSPACE) {
+        return NFS_ERROR_NONE;
+    }
+    if (nfs_journal_split() < 0) {
+        return -NFS_ERROR_IO;
     }
+    return nfs_bmeta(blk);
+}
 
-    free(temp_content);
+/**
+ * @brief 写元数据，写入的逻辑块在提交写入日志之前不会被写回原位置
+ * 
+ * @param offset 
+ * @param in_content 
+ * @param size 
+ * @return int 
+ */
+static int nfs_driver_write_meta(int offset, uint8_t *in_content, int size) {
+    struct nfs_buf* buf;
+    int             blk  = NFS_BLK_NO(offset);
+    int             bias = offset - NFS_BLKS_SZ(blk);
+    int             len;
+    // 与nfs_driver_write相同，只是每块先标记为元数据再修改
+    nfs_bcache_lock();
+    while (size > 0) {
+        len = NFS_BLKS_SZ(1) - bias < size ? NFS_BLKS_SZ(1) - bias : size;
+        buf = (len == NFS_BLKS_SZ(1)) ? nfs_bget(blk) : nfs_bread(blk);
+        if (buf == NULL || nfs_mark_meta(blk) != NFS_ERROR_NONE) {
+            nfs_bcache_unlock();
+            return -NFS_ERROR_IO;
+        }
+        memcpy(buf->data + bias, in_content, len);
+        nfs_bdirty(buf);
+        in_content += len;
+        size       -= len;
+        bias        = 0;
+        blk++;
+    }
+    nfs_bcache_unlock();
     return NFS_ERROR_NONE;
 }
 
 /**
- * @brief 将denry插入到inode中，采用头插法
+ * @brief 保证block_pointer/block_dirty数组至少能容纳cap个数据块
+ * 
+ * @param inode 
+ * @param cap 
+ * @return int 
+ */
+static int nfs_inode_reserve(struct nfs_inode* inode, int cap) {
+    uint8_t** pointer;
+    uint8_t*  dirty;
+    int       new_cap = inode->block_cap == 0 ? 8 : inode->block_cap;
+
+    if (cap <= inode->block_cap) {
+        return NFS_ERROR_NONE;
+    }
+    while (new_cap < cap) {
+        new_cap *= 2;
+    }
+    pointer = (uint8_t**)realloc(inode->block_pointer, new_cap * sizeof(uint8_t*));
+    if (pointer == NULL) {
+        return -NFS_ERROR_NOMEM;
+    }
+    inode->block_pointer = pointer;
+    dirty = (uint8_t*)realloc(inode->block_dirty, new_cap);
+    if (dirty == NULL) {
+        return -NFS_ERROR_NOMEM;
+    }
+    inode->block_dirty = dirty;
+    memset(inode->block_pointer + inode->block_cap, 0, (new_cap - inode->block_cap) * sizeof(uint8_t*));
+    memset(inode->block_dirty + inode->block_cap, 0, new_cap - inode->block_cap);
+    inode->block_cap = new_cap;
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 标记inode为脏，并挂到脏inode链表上
+ * 
+ * @param inode 
+ * @param flags NFS_INODE_DIRTY_META | NFS_INODE_DIRTY_DATA
+ */
+void nfs_inode_dirty(struct nfs_inode* inode, int flags) {
+    pthread_mutex_lock(&nfs_super.dirty_lock);
+    if (inode->dirty == 0) {   // 追加到链表末尾，链表头总是最早变脏的inode
+        inode->dirty_time = time(NULL);
+        inode->dirty_prev = nfs_super.dirty_tail;
+        inode->dirty_next = NULL;
+        if (nfs_super.dirty_tail != NULL) {
+            nfs_super.dirty_tail->dirty_next = inode;
+        }
+        else {
+            nfs_super.dirty_inodes = inode;
+        }
+        nfs_super.dirty_tail = inode;
+    }
+    inode->dirty |= flags;
+    pthread_mutex_unlock(&nfs_super.dirty_lock);
+}
+
+/**
+ * @brief 标记inode的第blk_no个数据块为脏，调用者需保证block_dirty数组足够大
+ * 
+ * @param inode 
+ * @param blk_no 文件内的逻辑块号
+ */
+void nfs_inode_dirty_block(struct nfs_inode* inode, int blk_no) {
+    if (!inode->block_dirty[blk_no]) {
+        inode->block_dirty[blk_no] = 1;
+        if (__atomic_add_fetch(&nfs_super.dirty_blks, 1, __ATOMIC_RELAXED) - 1 == nfs_super.dirty_bg) {
+            nfs_flush_kick();   // 脏块数刚超过后台写回阈值
+        }
+    }
+    nfs_inode_dirty(inode, NFS_INODE_DIRTY_DATA);
+}
+
+/**
+ * @brief 更新inode的时间戳并标记inode需要写回，调用者需持有inode写锁或inode尚未发布
+ * getattr不加锁读取，秒和纳秒分别发布，并发时可能读到新旧混合的值
+ * 
+ * @param inode 
+ * @param flags NFS_TIME_ATIME | NFS_TIME_MTIME | NFS_TIME_CTIME
+ * @param ts 新的时间，NULL表示当前时间
+ */
+void nfs_inode_touch(struct nfs_inode* inode, int flags, const struct timespec* ts) {
+    struct timespec now;
+
+    if (ts == NULL) {
+        clock_gettime(CLOCK_REALTIME, &now);
+        ts = &now;
+    }
+    if (flags & NFS_TIME_ATIME) {
+        NFS_STORE(inode->atime.tv_sec, ts->tv_sec);
+        NFS_STORE(inode->atime.tv_nsec, ts->tv_nsec);
+    }
+    if (flags & NFS_TIME_MTIME) {
+        NFS_STORE(inode->mtime.tv_sec, ts->tv_sec);
+        NFS_STORE(inode->mtime.tv_nsec, ts->tv_nsec);
+    }
+    if (flags & NFS_TIME_CTIME) {
+        NFS_STORE(inode->ctime.tv_sec, ts->tv_sec);
+        NFS_STORE(inode->ctime.tv_nsec, ts->tv_nsec);
+    }
+    nfs_inode_dirty(inode, NFS_INODE_DIRTY_META);
+}
+
+/**
+ * @brief 清除inode第blk_no个数据块的脏标记
+ * 
+ * @param inode 
+ * @param blk_no 文件内的逻辑块号
+ */
+static void nfs_inode_clean_block(struct nfs_inode* inode, int blk_no) {
+    if (inode->block_dirty[blk_no]) {
+        inode->block_dirty[blk_no] = 0;
+        __atomic_sub_fetch(&nfs_super.dirty_blks, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * @brief inode已全部写回，清除脏标记并从脏inode链表上摘下
+ * 
+ * @param inode 
+ */
+static void nfs_inode_clean(struct nfs_inode* inode) {
+    pthread_mutex_lock(&nfs_super.dirty_lock);
+    if (inode->dirty == 0) {
+        pthread_mutex_unlock(&nfs_super.dirty_lock);
+        return;
+    }
+    if (inode->dirty_prev != NULL) {
+        inode->dirty_prev->dirty_next = inode->dirty_next;
+    }
+    else {
+        nfs_super.dirty_inodes = inode->dirty_next;
+    }
+    if (inode->dirty_next != NULL) {
+        inode->dirty_next->dirty_prev = inode->dirty_prev;
+    }
+    else {
+        nfs_super.dirty_tail = inode->dirty_prev;
+    }
+    inode->dirty_prev = NULL;
+    inode->dirty_next = NULL;
+    inode->dirty      = 0;
+    pthread_mutex_unlock(&nfs_super.dirty_lock);
+}
+
+/**
+ * @brief 将denry插入到inode中，追加在末尾，这样已有目录项在磁盘上的位置不变，只有最后一个目录项块变脏
+ * 最后一个目录项块放不下新记录时为目录分配一个新的数据块
+ * 目录的size为最后一个目录项块之前的块大小加上该块已用的字节数
  * 
  * @param inode 父目录inode
  * @param dentry 
- * @return int 
+ * @return int 目录项个数，没有空间时返回错误码且dentry不会被插入
  */
 int nfs_alloc_dentry(struct nfs_inode* inode, struct nfs_dentry* dentry) {
-    if (inode->dentrys == NULL) {
-        inode->dentrys = dentry;
+    int rec_len = NFS_DIRENT_SZ(dentry->name_len);
+    int blk_no  = 0;   // 新目录项所在的目录项块
+    int used    = sizeof(struct nfs_dir_blk_d);   // 该块中已用的字节数
+    int ret;
+
+    if (inode->dentrys_tail != NULL) {
+        blk_no = inode->dentrys_tail->blk;
+        used   = inode->size - NFS_BLKS_SZ(blk_no);
+        if (used + rec_len > NFS_BLKS_SZ(1)) {
+            blk_no++;
+            used = sizeof(struct nfs_dir_blk_d);
+        }
     }
-    else {
-        dentry->brother = inode->dentrys;
-        inode->dentrys = dentry;
+    if (nfs_inode_reserve(inode, blk_no + 1) != NFS_ERROR_NONE) {
+        return -NFS_ERROR_NOMEM;
     }
-    inode->dir_cnt++;
-    inode->size += sizeof(struct nfs_dentry);   // 更新占用空间
-    if(inode->dir_cnt % (NFS_BLKS_SZ(1) / sizeof(struct nfs_dentry)) == 1){
+    if (blk_no >= inode->block_num) {
         // inode原有的数据块已满（或初始时未分配数据块）需要分配一个新的数据块
-        inode->block_index[inode->block_num] = nfs_alloc_data();
-        inode->block_num++;
+        ret = nfs_inode_extend(inode, 1);
+        if (ret != NFS_ERROR_NONE) {
+            return ret;
+        }
+    }
+    dentry->brother = NULL;
+    dentry->blk     = blk_no;
+    // dentry的内容在发布之前已经填好，无锁的读者从链表或哈希索引看到它时内容一定完整
+    if (inode->dentrys == NULL) {
+        NFS_STORE(inode->dentrys, dentry);
     }
+    else {
+        NFS_STORE(inode->dentrys_tail->brother, dentry);
+    }
+    inode->dentrys_tail = dentry;
+    nfs_dir_index_add(inode, dentry);   // 若已建立哈希索引，同步插入
+    nfs_icache_charge(sizeof(struct nfs_dentry));
+    NFS_STORE(inode->dir_cnt, inode->dir_cnt + 1);
+    NFS_STORE(inode->size, NFS_BLKS_SZ(blk_no) + used + rec_len);   // 更新占用空间
+    nfs_inode_touch(inode, NFS_TIME_MTIME | NFS_TIME_CTIME, NULL);
+    nfs_inode_dirty_block(inode, blk_no);
     return inode->dir_cnt;
 }
 
+/**
+ * @brief 创建目录项，从目录项对象池中分配，文件名复制到所在目录的文件名存储区
+ * 调用者需持有dir的写锁或dir尚未发布；创建失败而被丢弃的目录项，其文件名仍占用存储区直到目录被释放
+ *
+ * @param dir 所在目录的inode，NULL表示根目录项
+ * @param fname 以'\0'结尾的文件名，长度不超过MAX_NAME_LEN
+ * @param ftype 文件类型
+ * @return struct nfs_dentry* 内存不足时返回NULL
+ */
+struct nfs_dentry* new_dentry(struct nfs_inode* dir, const char* fname, NFS_FILE_TYPE ftype) {
+    struct nfs_dentry* dentry = (struct nfs_dentry*)nfs_slab_alloc(&nfs_super.dentry_slab);
+    int                len    = strlen(fname);   // 调用者保证不超过MAX_NAME_LEN
+
+    if (dentry == NULL) {
+        return NULL;
+    }
+    memset(dentry, 0, sizeof(struct nfs_dentry));
+    dentry->name     = dir != NULL ? nfs_dir_name_store(dir, fname, len) : "/";
+    if (dentry->name == NULL) {
+        nfs_slab_free(&nfs_super.dentry_slab, dentry);
+        return NULL;
+    }
+    dentry->name_len = len;
+    dentry->hash     = nfs_name_hash(dentry->name);
+    dentry->ftype    = ftype;
+    dentry->ino      = -1;
+    dentry->inode    = NULL;
+    dentry->parent   = NULL;
+    dentry->brother  = NULL;
+    return dentry;
+}
+
 /**
  * @brief 分配一个inode，占用位图
  * 
  * @param dentry 该dentry指向分配的inode
- * @return nfs_inode
+ * @return nfs_inode 没有空闲inode时返回-NFS_ERROR_NOSPACE，内存不足时返回-NFS_ERROR_NOMEM
  */
 struct nfs_inode* nfs_alloc_inode(struct nfs_dentry * dentry) {
     struct nfs_inode* inode;
-    int byte_cursor = 0; 
-    int bit_cursor  = 0; 
-    int ino_cursor  = 0;
-    boolean is_find_free_entry = FALSE;
-    /* 检查inode位图是否有空位 */
-    for (byte_cursor = 0; byte_cursor < NFS_BLKS_SZ(nfs_super.map_inode_blks); 
-         byte_cursor++)
-    {
-        for (bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++) {
-            if((nfs_super.map_inode[byte_cursor] & (0x1 << bit_cursor)) == 0) {    
-                                                      /* 当前ino_cursor位置空闲 */
-                nfs_super.map_inode[byte_cursor] |= (0x1 << bit_cursor);   // 将对应位置置1
-                is_find_free_entry = TRUE;           
-                break;
-            }
-            ino_cursor++;
-        }
-        if (is_find_free_entry) {
-            break;
-        }
-    }
+    int ino_cursor;
+
+    pthread_mutex_lock(&nfs_super.bm_lock);
+    ino_cursor = nfs_bitmap_alloc(&nfs_super.inode_bm);   /* 按字扫描inode位图查找空位 */
+    pthread_mutex_unlock(&nfs_super.bm_lock);
 
-    if (!is_find_free_entry || ino_cursor == nfs_super.max_ino)
+    if (ino_cursor < 0)
         return (struct nfs_inode *)-NFS_ERROR_NOSPACE;
 
-    inode = (struct nfs_inode*)malloc(sizeof(struct nfs_inode));
+    inode = (struct nfs_inode*)nfs_slab_alloc(&nfs_super.inode_slab);
+    if (inode == NULL) {
+        nfs_free_inode(ino_cursor);
+        return (struct nfs_inode *)-NFS_ERROR_NOMEM;
+    }
     inode->ino  = ino_cursor; 
     inode->size = 0;
     inode->block_num = 0;
@@ -173,46 +419,311 @@ struct nfs_inode* nfs_alloc_inode(struct nfs_dentry * dentry) {
     
     inode->dir_cnt = 0;
     inode->dentrys = NULL;
+    inode->htab    = NULL;
+    inode->names   = NULL;
+    inode->ref     = 0;
+    inode->extents       = NULL;
+    inode->extent_num    = 0;
+    inode->extent_cap    = 0;
+    inode->extent_blk    = -1;
+    inode->block_pointer = NULL;
+    inode->block_dirty   = NULL;
+    inode->block_cap     = 0;
+    inode->dentrys_tail  = NULL;
+    inode->dirty         = 0;
+    pthread_rwlock_init(&inode->lock, NULL);
+    if (dentry->ftype == NFS_DIR) {
+        nfs_dir_index_build(inode);   // 目录的哈希索引在创建时建立，之后的查找不加锁
+    }
+    nfs_inode_dirty(inode, NFS_INODE_DIRTY_META | NFS_INODE_DIRTY_NEW);   // 新inode需要写回
+    nfs_inode_touch(inode, NFS_TIME_ATIME | NFS_TIME_MTIME | NFS_TIME_CTIME, NULL);
+    nfs_icache_charge(sizeof(struct nfs_inode));
+    pthread_mutex_lock(&nfs_super.load_lock);
+    nfs_icache_add(inode);
+    pthread_mutex_unlock(&nfs_super.load_lock);
 
     return inode;
 }
 
+/**
+ * @brief 撤销一个刚分配、尚未插入目录的inode，释放其位图占用和内存
+ * 
+ * @param inode 
+ */
+void nfs_discard_inode(struct nfs_inode* inode) {
+    pthread_mutex_lock(&nfs_super.load_lock);
+    nfs_icache_del(inode);
+    pthread_mutex_unlock(&nfs_super.load_lock);
+    nfs_icache_charge(-(long)sizeof(struct nfs_inode));
+    nfs_inode_clean(inode);
+    nfs_free_inode(inode->ino);
+    pthread_rwlock_destroy(&inode->lock);
+    free(inode->htab);
+    nfs_icache_charge(-nfs_dir_names_free(inode));
+    nfs_slab_free(&nfs_super.inode_slab, inode);
+}
+
+/**
+ * @brief 在目录下新建文件或目录: 持父目录写锁重新检查同名，再分配inode并插入目录项
+ * 调用者需已调用nfs_journal_begin，保证parent不会被inode缓存回收，且提交时看到的是完整的操作
+ * 
+ * @param parent 父目录的inode
+ * @param fname 文件名
+ * @param ftype 文件类型
+ * @param dentry 返回新建的目录项，可以为NULL
+ * @return int 0成功，否则返回对应错误号
+ */
+int nfs_create(struct nfs_inode* parent, const char* fname, NFS_FILE_TYPE ftype, struct nfs_dentry** dentry) {
+    struct nfs_dentry* new;
+    struct nfs_inode*  inode;
+    int                ret;
+
+    if (strlen(fname) > MAX_NAME_LEN) {   // 磁盘目录项放不下，不截断
+        return -NFS_ERROR_NAMETOOLONG;
+    }
+    pthread_rwlock_wrlock(&parent->lock);
+    if (nfs_dir_lookup(parent, fname) != NULL) {   // 查找之后可能已被其他线程创建
+        pthread_rwlock_unlock(&parent->lock);
+        return -NFS_ERROR_EXISTS;
+    }
+    new = new_dentry(parent, fname, ftype);
+    if (new == NULL) {
+        pthread_rwlock_unlock(&parent->lock);
+        return -NFS_ERROR_NOMEM;
+    }
+    new->parent = parent->dentry;
+    inode = nfs_alloc_inode(new);   // 为目录项分配一个inode
+    if (inode == (struct nfs_inode *)-NFS_ERROR_NOSPACE || inode == (struct nfs_inode *)-NFS_ERROR_NOMEM) {
+        pthread_rwlock_unlock(&parent->lock);
+        nfs_slab_free(&nfs_super.dentry_slab, new);
+        return inode == (struct nfs_inode *)-NFS_ERROR_NOSPACE ? -NFS_ERROR_NOSPACE : -NFS_ERROR_NOMEM;
+    }
+    ret = nfs_alloc_dentry(parent, new);   // 将dentry插入到父目录inode中
+    pthread_rwlock_unlock(&parent->lock);
+    if (ret < 0) {   // 父目录无法再分配数据块
+        nfs_discard_inode(inode);
+        nfs_slab_free(&nfs_super.dentry_slab, new);
+        return ret;
+    }
+    if (dentry != NULL) {
+        *dentry = new;
+    }
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 释放inode在位图中的占用
+ * 
+ * @param ino inode编号
+ */
+void nfs_free_inode(int ino) {
+    pthread_mutex_lock(&nfs_super.bm_lock);
+    nfs_bitmap_free(&nfs_super.inode_bm, ino, 1);
+    pthread_mutex_unlock(&nfs_super.bm_lock);
+}
+
 /**
  * @brief 分配一个数据块，占用位图
  * 
  * @return 分配的数据块号
  */
 int nfs_alloc_data(){
-    int byte_cursor = 0; 
-    int bit_cursor  = 0; 
-    int ino_cursor  = 0;
-    boolean is_find_free_entry = FALSE;
-    /* 检查数据位图是否有空位 */
-    for (byte_cursor = 0; byte_cursor < NFS_BLKS_SZ(nfs_super.map_data_blks); 
-         byte_cursor++)
-    {
-        for (bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++) {
-            if((nfs_super.map_data[byte_cursor] & (0x1 << bit_cursor)) == 0) {    
-                                                      /* 当前ino_cursor位置空闲 */  
-                nfs_super.map_data[byte_cursor] |= (0x1 << bit_cursor);      // 将对应位置置1
-                is_find_free_entry = TRUE;           
-                break;
-            }
-            ino_cursor++;
+    int data_no;
+    pthread_mutex_lock(&nfs_super.bm_lock);
+    data_no = nfs_bitmap_alloc(&nfs_super.data_bm);   /* 按字扫描数据位图查找空位 */
+    pthread_mutex_unlock(&nfs_super.bm_lock);
+    return data_no;
+}
+
+/**
+ * @brief 分配n个连续的数据块，占用位图
+ * 
+ * @param n 数据块数量
+ * @return 第一个数据块的块号
+ */
+int nfs_alloc_data_range(int n){
+    int data_no;
+    pthread_mutex_lock(&nfs_super.bm_lock);
+    data_no = nfs_bitmap_alloc_range(&nfs_super.data_bm, n);
+    pthread_mutex_unlock(&nfs_super.bm_lock);
+    return data_no;
+}
+
+/**
+ * @brief 释放从data_no开始的n个数据块
+ * 
+ * @param data_no 第一个数据块的块号
+ * @param n 数据块数量
+ */
+void nfs_free_data(int data_no, int n){
+    nfs_journal_revoke(NFS_DATA_BLK(data_no), n);   // 日志中的旧镜像不能在重放时覆盖重新分配后的内容
+    pthread_mutex_lock(&nfs_super.bm_lock);
+    nfs_bitmap_free(&nfs_super.data_bm, data_no, n);
+    pthread_mutex_unlock(&nfs_super.bm_lock);
+}
+
+/**
+ * @brief 查找文件内第blk_no个逻辑块对应的数据块号
+ * 
+ * @param inode 
+ * @param blk_no 文件内的逻辑块号
+ * @return int 数据块号，超出已分配范围返回-1
+ */
+int nfs_bmap(struct nfs_inode* inode, int blk_no) {
+    struct nfs_extent* ext;
+    for (int i = 0; i < inode->extent_num; i++) {
+        ext = &inode->extents[i];
+        if (blk_no < ext->len) {
+            return ext->start + blk_no;
         }
-        if (is_find_free_entry) {
-            break;
+        blk_no -= ext->len;
+    }
+    return -1;
+}
+
+/**
+ * @brief 在extent表末尾追加一段数据块，与最后一个extent相邻时直接合并
+ * 
+ * @param inode 
+ * @param start 起始数据块号
+ * @param len 数据块数量
+ * @return int 
+ */
+static int nfs_extent_append(struct nfs_inode* inode, int start, int len) {
+    struct nfs_extent* ext;
+    int                cap;
+
+    if (inode->extent_num > 0) {
+        ext = &inode->extents[inode->extent_num - 1];
+        if (ext->start + ext->len == start) {
+            ext->len += len;
+            nfs_inode_dirty(inode, NFS_INODE_DIRTY_META);
+            return NFS_ERROR_NONE;
+        }
+    }
+    if (inode->extent_num >= NFS_EXTENT_MAX()) {
+        return -NFS_ERROR_FBIG;
+    }
+    if (inode->extent_num == NFS_EXTENT_INLINE && inode->extent_blk < 0) {
+        // inode中的extent已用完，分配溢出extent块
+        inode->extent_blk = nfs_alloc_data();
+        if (inode->extent_blk < 0) {
+            inode->extent_blk = -1;
+            return -NFS_ERROR_NOSPACE;
         }
     }
+    if (inode->extent_num == inode->extent_cap) {
+        cap = inode->extent_cap == 0 ? 4 : inode->extent_cap * 2;
+        ext = (struct nfs_extent*)realloc(inode->extents, cap * sizeof(struct nfs_extent));
+        if (ext == NULL) {
+            return -NFS_ERROR_NOMEM;
+        }
+        inode->extents    = ext;
+        inode->extent_cap = cap;
+    }
+    inode->extents[inode->extent_num].start = start;
+    inode->extents[inode->extent_num].len   = len;
+    inode->extent_num++;
+    nfs_inode_dirty(inode, NFS_INODE_DIRTY_META);
+    return NFS_ERROR_NONE;
+}
 
-    if (!is_find_free_entry || ino_cursor == nfs_super.max_data)
-        return -NFS_ERROR_NOSPACE;
+/**
+ * @brief 释放文件末尾的数据块，使文件只保留blk_cnt个数据块
+ * 
+ * @param inode 
+ * @param blk_cnt 保留的数据块数量
+ */
+void nfs_inode_shrink(struct nfs_inode* inode, int blk_cnt) {
+    struct nfs_extent* ext;
+    int                n;
 
-    return ino_cursor;
+    if (inode->block_num > blk_cnt) {
+        nfs_inode_dirty(inode, NFS_INODE_DIRTY_META);
+    }
+    while (inode->block_num > blk_cnt) {
+        ext = &inode->extents[inode->extent_num - 1];
+        n   = inode->block_num - blk_cnt < ext->len ? inode->block_num - blk_cnt : ext->len;
+        nfs_free_data(ext->start + ext->len - n, n);
+        ext->len         -= n;
+        NFS_STORE(inode->block_num, inode->block_num - n);
+        if (ext->len == 0) {
+            inode->extent_num--;
+        }
+    }
+    for (int i = blk_cnt; i < inode->block_cap; i++) {
+        if (inode->block_pointer[i] != NULL) {
+            free(inode->block_pointer[i]);
+            inode->block_pointer[i] = NULL;
+            nfs_icache_charge(-NFS_BLKS_SZ(1));
+        }
+        nfs_inode_clean_block(inode, i);
+    }
+    if (inode->extent_num <= NFS_EXTENT_INLINE && inode->extent_blk >= 0) {
+        nfs_free_data(inode->extent_blk, 1);   // 不再需要溢出extent块
+        inode->extent_blk = -1;
+    }
 }
 
 /**
- * @brief 将内存inode及其下方结构全部刷回磁盘
+ * @brief 为inode在末尾追加n个数据块
+ * 优先紧接着最后一个extent原地扩展，其次分配一整段连续数据块，空间碎片化时逐步减半申请的长度
+ * 
+ * @param inode 
+ * @param n 追加的数据块数量
+ * @return int 失败时已追加的数据块会被释放
+ */
+int nfs_inode_extend(struct nfs_inode* inode, int n) {
+    struct nfs_extent* ext;
+    int                old_num = inode->block_num;
+    int                next, len, start, ret;
+
+    while (n > 0) {
+        if (inode->extent_num > 0) {   // 原地扩展最后一个extent
+            ext  = &inode->extents[inode->extent_num - 1];
+            next = ext->start + ext->len;
+            pthread_mutex_lock(&nfs_super.bm_lock);
+            len = 0;
+            while (len < n && !nfs_bitmap_test(&nfs_super.data_bm, next + len)) {
+                len++;
+            }
+            if (len > 0) {
+                nfs_bitmap_set(&nfs_super.data_bm, next, len);
+            }
+            pthread_mutex_unlock(&nfs_super.bm_lock);
+            if (len > 0) {
+                ext->len         += len;
+                NFS_STORE(inode->block_num, inode->block_num + len);
+                n                -= len;
+                nfs_inode_dirty(inode, NFS_INODE_DIRTY_META);
+            }
+            if (n == 0) {
+                break;
+            }
+        }
+
+        len = n;
+        while ((start = nfs_alloc_data_range(len)) < 0 && len > 1) {
+            len = (len + 1) / 2;
+        }
+        if (start < 0) {
+            nfs_inode_shrink(inode, old_num);
+            return -NFS_ERROR_NOSPACE;
+        }
+        ret = nfs_extent_append(inode, start, len);
+        if (ret != NFS_ERROR_NONE) {
+            nfs_free_data(start, len);
+            nfs_inode_shrink(inode, old_num);
+            return ret;
+        }
+        NFS_STORE(inode->block_num, inode->block_num + len);
+        n                -= len;
+    }
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 将内存inode中被修改过的部分刷回磁盘(不递归写回子目录项的inode)
  * 
  * @param inode 
  * @return int 
@@ -220,74 +731,375 @@ int nfs_alloc_data(){
 int nfs_sync_inode(struct nfs_inode * inode) {
     struct nfs_inode_d  inode_d;
     struct nfs_dentry*  dentry_cursor;
-    struct nfs_dentry_d dentry_d;
-
-    // 填写inode_d相关数据
-    int ino             = inode->ino;
-    inode_d.ino         = ino;
-    inode_d.size        = inode->size;
-    inode_d.block_num   = inode->block_num;
-    inode_d.ftype       = inode->dentry->ftype;
-    inode_d.dir_cnt     = inode->dir_cnt;
-    // 只刷回有效的block_index
-    for(int i = 0; i < inode->block_num; i++){
-        inode_d.block_index[i] = inode->block_index[i];
+    uint8_t             blk_buf[NFS_BLKS_SZ(1)];   // 凑满一个数据块的目录项后整块写回
+    struct nfs_dir_blk_d* blk_d = (struct nfs_dir_blk_d *)blk_buf;
+    struct nfs_dirent_d*  dirent_d;
+    int                 ino     = inode->ino;
+    int                 b;
+
+    // 内嵌文件的内容在inode槽中，内容变脏即inode本身变脏
+    if (NFS_IS_INLINE(inode) && (inode->dirty & NFS_INODE_DIRTY_DATA)) {
+        inode->dirty |= NFS_INODE_DIRTY_META;
     }
-    int offset;
-
     /* 先写inode本身 */
-    if (nfs_driver_write(NFS_INO_OFS(ino), (uint8_t *)&inode_d, 
-                     sizeof(struct nfs_inode_d)) != NFS_ERROR_NONE) {
-        NFS_DBG("[%s] io error\n", __func__);
-        return -NFS_ERROR_IO;
+    if (inode->dirty & NFS_INODE_DIRTY_META) {
+        // 填写inode_d相关数据
+        memset(&inode_d, 0, sizeof(struct nfs_inode_d));
+        inode_d.ino         = ino;
+        inode_d.size        = inode->size;
+        inode_d.block_num   = inode->block_num;
+        inode_d.ftype       = inode->dentry->ftype;
+        inode_d.dir_cnt     = inode->dir_cnt;
+        inode_d.extent_num  = inode->extent_num;
+        inode_d.extent_blk  = inode->extent_blk;
+        inode_d.atime       = inode->atime.tv_sec;
+        inode_d.atime_ns    = inode->atime.tv_nsec;
+        inode_d.mtime       = inode->mtime.tv_sec;
+        inode_d.mtime_ns    = inode->mtime.tv_nsec;
+        inode_d.ctime       = inode->ctime.tv_sec;
+        inode_d.ctime_ns    = inode->ctime.tv_nsec;
+        // 前NFS_EXTENT_INLINE个extent存放在inode中
+        if (inode->extent_num > 0) {
+            memcpy(inode_d.extents, inode->extents, 
+                   (inode->extent_num < NFS_EXTENT_INLINE ? inode->extent_num : NFS_EXTENT_INLINE) * sizeof(struct nfs_extent));
+        }
+        if (NFS_IS_INLINE(inode) && inode->size > 0) {
+            memcpy(inode_d.inline_data, inode->block_pointer[0], inode->size);
+        }
+
+        if (nfs_driver_write_meta(NFS_INO_OFS(ino), (uint8_t *)&inode_d, 
+                         sizeof(struct nfs_inode_d)) != NFS_ERROR_NONE) {
+            NFS_DBG("[%s] io error\n", __func__);
+            return -NFS_ERROR_IO;
+        }
+        // 其余extent写入溢出extent块
+        if (inode->extent_num > NFS_EXTENT_INLINE) {
+            if (nfs_driver_write_meta(NFS_DATA_OFS(inode->extent_blk), (uint8_t *)(inode->extents + NFS_EXTENT_INLINE), 
+                                 (inode->extent_num - NFS_EXTENT_INLINE) * sizeof(struct nfs_extent)) != NFS_ERROR_NONE) {
+                NFS_DBG("[%s] io error\n", __func__);
+                return -NFS_ERROR_IO;
+            }
+        }
     }
 
-    /* 再写inode下方的数据 */
-    if (NFS_IS_DIR(inode)) { /* 如果当前inode是目录，那么数据是目录项，且目录项的inode也要写回 */                          
+    /* 再写inode下方被修改过的数据块 */
+    if (!(inode->dirty & NFS_INODE_DIRTY_DATA)) {
+        nfs_inode_clean(inode);
+        return NFS_ERROR_NONE;
+    }
+    if (NFS_IS_DIR(inode)) { /* 如果当前inode是目录，那么数据是目录项 */                          
+        // 目录项按顺序紧凑存放，dentry->blk记录所在的目录项块，只重新编码并写回脏的目录项块
         dentry_cursor = inode->dentrys;
-        int i = 0;   // 循环变量，记录写回的是第几个block_index指向的数据块
-        while (dentry_cursor != NULL && i <= inode->block_num)
-        {
-            offset        = NFS_DATA_OFS(inode->block_index[i]);
-            // 循环写回所有的dentry
-            while(dentry_cursor != NULL && (offset += sizeof(struct nfs_dentry_d) != NFS_DATA_OFS(inode->block_index[i] + 1))){
-                // 填写dentry_d相关信息
-                memcpy(dentry_d.name, dentry_cursor->name, MAX_NAME_LEN);     
-                dentry_d.ftype = dentry_cursor->ftype;
-                printf("dentry_d_name = %s, type = %d\n", dentry_d.name, dentry_d.ftype);
-                dentry_d.ino = dentry_cursor->ino;
-                if (nfs_driver_write(offset, (uint8_t *)&dentry_d, 
-                                    sizeof(struct nfs_dentry_d)) != NFS_ERROR_NONE) {
-                    NFS_DBG("[%s] io error\n", __func__);
-                    return -NFS_ERROR_IO;                     
+        while (dentry_cursor != NULL) {
+            b = dentry_cursor->blk;
+            if (b >= inode->block_cap || !inode->block_dirty[b]) {
+                while (dentry_cursor != NULL && dentry_cursor->blk == b) {
+                    dentry_cursor = dentry_cursor->brother;
                 }
-                
-                // 目录项不为空，写回目录项的文件
-                if (dentry_cursor->inode != NULL) {
-                    nfs_sync_inode(dentry_cursor->inode);
-                }
-
+                continue;
+            }
+            memset(blk_buf, 0, NFS_BLKS_SZ(1));
+            blk_d->magic   = NFS_DIR_BLK_MAGIC;
+            blk_d->version = NFS_DIR_BLK_VERSION;
+            blk_d->used    = sizeof(struct nfs_dir_blk_d);
+            while (dentry_cursor != NULL && dentry_cursor->blk == b) {
+                // 填写dirent_d相关信息
+                dirent_d = (struct nfs_dirent_d *)(blk_buf + blk_d->used);
+                dirent_d->ino      = dentry_cursor->ino;
+                dirent_d->ftype    = dentry_cursor->ftype;
+                dirent_d->name_len = dentry_cursor->name_len;
+                dirent_d->rec_len  = NFS_DIRENT_SZ(dentry_cursor->name_len);
+                memcpy(dirent_d + 1, dentry_cursor->name, dentry_cursor->name_len);
+                blk_d->used  += dirent_d->rec_len;
+                blk_d->cnt++;
                 dentry_cursor = dentry_cursor->brother;
-                offset += sizeof(struct nfs_dentry_d);
-
-            }            
-            i++;
+            }
+            if (nfs_driver_write_meta(NFS_DATA_OFS(nfs_bmap(inode, b)), blk_buf, 
+                                 NFS_BLKS_SZ(1)) != NFS_ERROR_NONE) {
+                NFS_DBG("[%s] io error\n", __func__);
+                return -NFS_ERROR_IO;                     
+            }
+            nfs_inode_clean_block(inode, b);
+        }
+    }
+    else if (NFS_IS_INLINE(inode)) {   // 内容已随inode写回
+        if (inode->block_cap > 0) {
+            nfs_inode_clean_block(inode, 0);
         }
     }
-    else if (NFS_IS_REG(inode)) { /* 如果当前inode是文件，那么数据是文件内容，直接把数据块内容写回block_index指向的磁盘块即可 */
-        // 由于实验不要求文件的写，下面的循环实际不会执行
-        for(int j = 0; j < inode->block_num; j++){
-            if (nfs_driver_write(NFS_DATA_OFS(inode->block_index[j]), inode->block_pointer[j], 
+    else if (NFS_IS_REG(inode)) { /* 如果当前inode是文件，那么数据是文件内容，把被修改过的数据块写回对应的磁盘块即可 */
+        for(int j = 0; j < inode->block_num && j < inode->block_cap; j++){
+            if (!inode->block_dirty[j]) {
+                continue;
+            }
+            if (inode->block_pointer[j] == NULL) {
+                nfs_inode_clean_block(inode, j);
+                continue;
+            }
+            if (nfs_driver_write(NFS_DATA_OFS(nfs_bmap(inode, j)), inode->block_pointer[j], 
                                 NFS_BLKS_SZ(1)) != NFS_ERROR_NONE) {
                 NFS_DBG("[%s] io error\n", __func__);
                 return -NFS_ERROR_IO;
             }
+            nfs_inode_clean_block(inode, j);
+        }
+    }
+    nfs_inode_clean(inode);
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 将所有脏inode和被修改过的位图写入块缓存，元数据块等待提交写入日志，
+ * 调用者需持有日志的txn_lock写锁
+ * 
+ * @return int 写回的inode数，失败返回错误码
+ */
+int nfs_sync_inodes() {
+    struct nfs_inode* inode;
+    int inode_cnt = 0, ret;
+
+    while (TRUE) {
+        pthread_mutex_lock(&nfs_super.dirty_lock);
+        inode = nfs_super.dirty_inodes;
+        pthread_mutex_unlock(&nfs_super.dirty_lock);
+        if (inode == NULL) {
+            break;
+        }
+        pthread_rwlock_wrlock(&inode->lock);
+        ret = nfs_sync_inode(inode);
+        pthread_rwlock_unlock(&inode->lock);
+        if (ret != NFS_ERROR_NONE) {
+            return -NFS_ERROR_IO;
+        }
+        inode_cnt++;
+    }
+
+    pthread_mutex_lock(&nfs_super.bm_lock);
+
+    // 将inode位图写入磁盘
+    if (nfs_super.inode_bm.dirty) {
+        if (nfs_driver_write_meta(nfs_super.map_inode_offset, (uint8_t *)(nfs_super.map_inode), 
+                             NFS_BLKS_SZ(nfs_super.map_inode_blks)) != NFS_ERROR_NONE) {
+            pthread_mutex_unlock(&nfs_super.bm_lock);
+            return -NFS_ERROR_IO;
+        }
+        nfs_super.inode_bm.dirty = FALSE;
+        nfs_super.inode_bm.freed = FALSE;
+    }
+
+    // 将数据块位图写入磁盘
+    if (nfs_super.data_bm.dirty) {
+        if (nfs_driver_write_meta(nfs_super.map_data_offset, (uint8_t *)(nfs_super.map_data), 
+                             NFS_BLKS_SZ(nfs_super.map_data_blks)) != NFS_ERROR_NONE) {
+            pthread_mutex_unlock(&nfs_super.bm_lock);
+            return -NFS_ERROR_IO;
+        }
+        nfs_super.data_bm.dirty = FALSE;
+        nfs_super.data_bm.freed = FALSE;
+    }
+    pthread_mutex_unlock(&nfs_super.bm_lock);
+    return inode_cnt;
+}
+
+/**
+ * @brief 在块缓存中的位图块上置位[start, start + n)，只有确实改变的字节所在的块才标记为元数据，
+ * 调用者需持有块缓存锁
+ * 
+ * @param offset 位图起始地址
+ * @param start 
+ * @param n 
+ * @return int 
+ */
+static int nfs_bitmap_image_set(int offset, int start, int n) {
+    struct nfs_buf* buf;
+    int             ofs;
+    uint8_t         mask;
+
+    for (int bit = start; bit < start + n; bit++) {
+        ofs  = offset + bit / 8;
+        mask = 1 << (bit % 8);
+        buf  = nfs_bread(NFS_BLK_NO(ofs));
+        if (buf == NULL) {
+            return -NFS_ERROR_IO;
+        }
+        if (!(buf->data[ofs - NFS_BLKS_SZ(NFS_BLK_NO(ofs))] & mask)) {
+            if (nfs_mark_meta(buf->blk) != NFS_ERROR_NONE) {
+                return -NFS_ERROR_IO;
+            }
+            buf->data[ofs - NFS_BLKS_SZ(NFS_BLK_NO(ofs))] |= mask;
+            nfs_bdirty(buf);
         }
-        
     }
     return NFS_ERROR_NONE;
 }
 
+/**
+ * @brief 只把inode自身占用的位(inode号、数据块、溢出extent块)写入块缓存中的位图块，
+ * 其余位保持上次写回时的内容，调用者需持有inode写锁
+ * 上次写回之后释放过位时，被释放的块可能已分配给该inode而旧的引用者尚未写回，只能整体写回
+ * 
+ * @param inode 
+ * @return int 有未写回的释放时返回-NFS_ERROR_AGAIN
+ */
+int nfs_sync_inode_bits(struct nfs_inode* inode) {
+    int ret = NFS_ERROR_NONE;
+
+    pthread_mutex_lock(&nfs_super.bm_lock);
+    if (nfs_super.inode_bm.freed || nfs_super.data_bm.freed) {
+        pthread_mutex_unlock(&nfs_super.bm_lock);
+        return -NFS_ERROR_AGAIN;
+    }
+    nfs_bcache_lock();
+    ret = nfs_bitmap_image_set(nfs_super.map_inode_offset, inode->ino, 1);
+    for (int i = 0; i < inode->extent_num && ret == NFS_ERROR_NONE; i++) {
+        ret = nfs_bitmap_image_set(nfs_super.map_data_offset, inode->extents[i].start, inode->extents[i].len);
+    }
+    if (ret == NFS_ERROR_NONE && inode->extent_blk >= 0) {
+        ret = nfs_bitmap_image_set(nfs_super.map_data_offset, inode->extent_blk, 1);
+    }
+    nfs_bcache_unlock();
+    pthread_mutex_unlock(&nfs_super.bm_lock);
+    return ret;
+}
+
+/**
+ * @brief 后台写回: 最早变脏的inode在expire及之前变脏，或脏块数超过target时，
+ * 提交所有脏数据并做检查点；日志中还有未检查点的事务时同样做检查点
+ * 
+ * @param expire 过期时刻，传入time(NULL)写回全部脏inode
+ * @param target 脏块数超过target时不论是否过期都写回
+ * @return int 本次写入设备的逻辑块数，失败返回错误码
+ */
+int nfs_sync_dirty(time_t expire, int target) {
+    boolean due;
+
+    pthread_mutex_lock(&nfs_super.dirty_lock);
+    due = nfs_super.dirty_inodes != NULL
+          && (nfs_super.dirty_inodes->dirty_time <= expire
+              || __atomic_load_n(&nfs_super.dirty_blks, __ATOMIC_RELAXED) > target);
+    pthread_mutex_unlock(&nfs_super.dirty_lock);
+    if (!due && !nfs_journal_pending()) {
+        return 0;
+    }
+    return nfs_journal_commit(TRUE);
+}
+
+/**
+ * @brief 按extent整段预读目录项块，每个目录项块只从块缓存中取一次并原地解码出所有目录项
+ * 
+ * @param inode 目录inode
+ * @param dir_cnt 磁盘上记录的目录项个数
+ * @return int 
+ */
+static int nfs_read_dentrys(struct nfs_inode* inode, int dir_cnt) {
+    struct nfs_dentry*    sub_dentry;
+    struct nfs_dir_blk_d* blk_d;
+    struct nfs_dirent_d*  dirent_d;
+    struct nfs_buf*       buf;
+    struct nfs_extent*    ext;
+    char                  name[MAX_NAME_LEN + 1];
+    int                   blk_no = 0;   // 目录内的逻辑块号
+    int                   chunk, cnt, ofs;
+
+    for (int i = 0; i < inode->extent_num && dir_cnt > 0; i++) {
+        ext = &inode->extents[i];
+        for (int j = 0; j < ext->len && dir_cnt > 0; j += chunk) {
+            chunk = ext->len - j < NFS_BUF_NUM / 2 ? ext->len - j : NFS_BUF_NUM / 2;
+            nfs_bcache_prefetch(NFS_DATA_BLK(ext->start + j), chunk);
+            for (int k = 0; k < chunk && dir_cnt > 0; k++, blk_no++) {
+                nfs_bcache_lock();   // 解码期间缓冲区不能被淘汰
+                buf = nfs_bread(NFS_DATA_BLK(ext->start + j + k));
+                if (buf == NULL) {
+                    nfs_bcache_unlock();
+                    return -NFS_ERROR_IO;
+                }
+                blk_d = (struct nfs_dir_blk_d *)buf->data;
+                if (blk_d->magic != NFS_DIR_BLK_MAGIC || blk_d->version != NFS_DIR_BLK_VERSION
+                    || blk_d->used > NFS_BLKS_SZ(1)) {
+                    NFS_DBG("[%s] bad dir block %d of inode %d\n", __func__, blk_no, inode->ino);
+                    nfs_bcache_unlock();
+                    return -NFS_ERROR_IO;
+                }
+                cnt = dir_cnt < blk_d->cnt ? dir_cnt : blk_d->cnt;
+                ofs = sizeof(struct nfs_dir_blk_d);
+                for (int d = 0; d < cnt; d++) {
+                    dirent_d = (struct nfs_dirent_d *)(buf->data + ofs);
+                    if (ofs + (int)sizeof(struct nfs_dirent_d) > blk_d->used || dirent_d->rec_len == 0
+                        || ofs + dirent_d->rec_len > blk_d->used || dirent_d->name_len > MAX_NAME_LEN) {
+                        NFS_DBG("[%s] bad dir record in block %d of inode %d\n", __func__, blk_no, inode->ino);
+                        nfs_bcache_unlock();
+                        return -NFS_ERROR_IO;
+                    }
+                    memcpy(name, dirent_d + 1, dirent_d->name_len);
+                    name[dirent_d->name_len] = '\0';
+                    ofs += dirent_d->rec_len;
+                    sub_dentry = new_dentry(inode, name, dirent_d->ftype);
+                    if (sub_dentry == NULL) {
+                        nfs_bcache_unlock();
+                        return -NFS_ERROR_NOMEM;
+                    }
+                    sub_dentry->parent = inode->dentry;
+                    sub_dentry->ino    = dirent_d->ino;
+                    sub_dentry->blk    = blk_no;
+                    if (inode->dentrys_tail == NULL) {
+                        inode->dentrys = sub_dentry;
+                    }
+                    else {
+                        inode->dentrys_tail->brother = sub_dentry;
+                    }
+                    inode->dentrys_tail = sub_dentry;
+                    inode->dir_cnt++;
+                    nfs_icache_charge(sizeof(struct nfs_dentry));   // 中途出错时已读入的目录项随inode一起回收
+                }
+                nfs_bcache_unlock();
+                dir_cnt -= cnt;
+            }
+        }
+    }
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 将目录中尚未读入的子目录项inode所在的inode表块预读进块缓存，用于readdir前
+ * NFS_INODE_PER_BLK个inode共用一个inode表块，兄弟inode之后直接从块缓存中读取，连续的inode表块只寻道一次
+ * 
+ * @param inode 目录inode
+ * @param async 是否交给预读线程，打开目录时异步预读，readdir时才读取inode
+ */
+void nfs_prefetch_inodes(struct nfs_inode* inode, boolean async) {
+    struct nfs_dentry* dentry_cursor;
+    int                base = NFS_BLK_NO(nfs_super.inode_offset);
+    int                nblks = nfs_super.max_ino / NFS_INODE_PER_BLK;
+    int                start;
+    uint8_t*           need;
+
+    if (NFS_LOAD(inode->dentrys) == NULL || (need = (uint8_t*)calloc(nblks, 1)) == NULL) {
+        return;
+    }
+    for (dentry_cursor = NFS_LOAD(inode->dentrys); dentry_cursor != NULL; dentry_cursor = NFS_LOAD(dentry_cursor->brother)) {
+        if (NFS_LOAD(dentry_cursor->inode) == NULL && dentry_cursor->ino / NFS_INODE_PER_BLK < nblks) {
+            need[dentry_cursor->ino / NFS_INODE_PER_BLK] = 1;
+        }
+    }
+    for (int i = 0; i < nblks; i++) {
+        if (!need[i]) {
+            continue;
+        }
+        start = i;
+        while (i < nblks && need[i] && i - start < NFS_BUF_NUM / 2) {
+            i++;
+        }
+        if (async) {
+            nfs_readahead_submit(base + start, i - start);
+        }
+        else {
+            nfs_bcache_prefetch(base + start, i - start);
+        }
+        i--;
+    }
+    free(need);
+}
+
 /**
  * @brief 从磁盘中读取inode节点
  * 
@@ -296,66 +1108,121 @@ int nfs_sync_inode(struct nfs_inode * inode) {
  * @return struct sfs_inode* 
  */
 struct nfs_inode* nfs_read_inode(struct nfs_dentry * dentry, int ino) {
-    struct nfs_inode* inode = (struct nfs_inode*)malloc(sizeof(struct nfs_inode));
+    struct nfs_inode* inode = (struct nfs_inode*)nfs_slab_alloc(&nfs_super.inode_slab);
     struct nfs_inode_d inode_d;
-    struct nfs_dentry* sub_dentry;
-    struct nfs_dentry_d dentry_d;
-    int    dir_cnt = 0, offset;
+
+    if (inode == NULL) {
+        NFS_DBG("[%s] no memory\n", __func__);
+        return NULL;
+    }
+    // 先初始化需要释放的字段，之后任何一步失败都经err统一回收
+    inode->dentry = dentry;
+    inode->dentrys = NULL;
+    inode->htab = NULL;
+    inode->names = NULL;
+    inode->extents = NULL;
+    inode->block_pointer = NULL;
+    inode->block_dirty = NULL;
+    inode->block_cap = 0;
+    pthread_rwlock_init(&inode->lock, NULL);
+    nfs_icache_charge(sizeof(struct nfs_inode));
+
     /* 从磁盘读索引结点 */
     if (nfs_driver_read(NFS_INO_OFS(ino), (uint8_t *)&inode_d, 
                         sizeof(struct nfs_inode_d)) != NFS_ERROR_NONE) {
-        NFS_DBG("[%s] io error\n", __func__);
-        return NULL;                    
+        goto err;
     }
     // 填写inode信息
     inode->dir_cnt = 0;
     inode->ino = inode_d.ino;
     inode->size = inode_d.size;
     inode->block_num = inode_d.block_num;
-    inode->dentry = dentry;
-    inode->dentrys = NULL;
-    // 只读有效的block_index
-    for(int j = 0; j < inode_d.block_num; j++){
-        inode->block_index[j] = inode_d.block_index[j];
+    inode->ref = 0;
+    inode->extent_num = inode_d.extent_num;
+    inode->extent_cap = inode_d.extent_num;
+    inode->extent_blk = inode_d.extent_blk;
+    inode->atime.tv_sec  = inode_d.atime;
+    inode->atime.tv_nsec = inode_d.atime_ns;
+    inode->mtime.tv_sec  = inode_d.mtime;
+    inode->mtime.tv_nsec = inode_d.mtime_ns;
+    inode->ctime.tv_sec  = inode_d.ctime;
+    inode->ctime.tv_nsec = inode_d.ctime_ns;
+    inode->dentrys_tail = NULL;
+    inode->dirty = 0;
+    inode->dirty_prev = NULL;
+    inode->dirty_next = NULL;
+    inode->referenced = 0;
+    inode->lru_prev = NULL;
+    inode->lru_next = NULL;
+    inode->extents = (struct nfs_extent*)malloc((inode->extent_num ? inode->extent_num : 1) * sizeof(struct nfs_extent));
+    if (inode->extents == NULL) {
+        goto err;
+    }
+    // 读取extent表，超出NFS_EXTENT_INLINE的部分在溢出extent块中
+    memcpy(inode->extents, inode_d.extents, 
+           (inode->extent_num < NFS_EXTENT_INLINE ? inode->extent_num : NFS_EXTENT_INLINE) * sizeof(struct nfs_extent));
+    if (inode->extent_num > NFS_EXTENT_INLINE) {
+        if (nfs_driver_read(NFS_DATA_OFS(inode->extent_blk), (uint8_t *)(inode->extents + NFS_EXTENT_INLINE), 
+                            (inode->extent_num - NFS_EXTENT_INLINE) * sizeof(struct nfs_extent)) != NFS_ERROR_NONE) {
+            goto err;
+        }
     }
 
     /* 内存中的inode的数据或子目录项部分也需要读出 */
     if (NFS_IS_DIR(inode)) {
-        dir_cnt = inode_d.dir_cnt;
-        int k = 0;   // 循环变量，记录读取的是第几个block_index指向的数据块
-        while(k < inode->block_num && dir_cnt > 0){
-            offset = NFS_DATA_OFS(inode->block_index[k]);
-            while (dir_cnt > 0 && (offset += sizeof(struct nfs_dentry_d) != NFS_DATA_OFS(inode->block_index[k] + 1)))
-            {
-                if (nfs_driver_read(offset, 
-                                    (uint8_t *)&dentry_d, 
-                                    sizeof(struct nfs_dentry_d)) != NFS_ERROR_NONE) {
-                    NFS_DBG("[%s] io error\n", __func__);
-                    return NULL;
-                }
-                sub_dentry = new_dentry(dentry_d.name, dentry_d.ftype);
-                sub_dentry->parent = inode->dentry;
-                sub_dentry->ino    = dentry_d.ino; 
-                nfs_alloc_dentry(inode, sub_dentry);   // 将sub_dentry插入到inode中
-                offset += sizeof(struct nfs_dentry_d);
-                dir_cnt--;
-            }
-            k++;
+        if (nfs_read_dentrys(inode, inode_d.dir_cnt) != NFS_ERROR_NONE) {
+            goto err;
         }
-        
+        nfs_dir_index_build(inode);   // 目录读入时建立哈希索引，之后的查找不加锁
     }
     else if (NFS_IS_REG(inode)) {
-        // 如果是文件类型直接读取数据即可
-        // inode->data = (uint8_t *)malloc(SFS_BLKS_SZ(SFS_DATA_PER_FILE));
-        // 空文件，实际不会执行下面的循环
-        for(int j = 0; j < inode->block_num; j++){
-            inode->block_pointer[j] = (uint8_t *)malloc(NFS_BLKS_SZ(1));
-            if (nfs_driver_read(NFS_DATA_OFS(inode->block_index[j]), (uint8_t *)inode->block_pointer[j], 
-                                NFS_BLKS_SZ(1)) != NFS_ERROR_NONE) {
-                NFS_DBG("[%s] io error\n", __func__);
-                return NULL;
+        // 文件的数据块在读写时才按需读入(nfs_inode_block)，这里只准备好指针数组
+        if (nfs_inode_reserve(inode, inode->block_num) != NFS_ERROR_NONE) {
+            goto err;
+        }
+        // 内嵌的内容随inode一起读出，放入block_pointer[0]，读写与普通数据块相同
+        if (NFS_IS_INLINE(inode) && inode->size > 0) {
+            if (nfs_inode_reserve(inode, 1) != NFS_ERROR_NONE
+                || (inode->block_pointer[0] = (uint8_t *)calloc(1, NFS_BLKS_SZ(1))) == NULL) {
+                goto err;
+            }
+            memcpy(inode->block_pointer[0], inode_d.inline_data, 
+                   inode->size < NFS_INLINE_MAX ? inode->size : NFS_INLINE_MAX);
+            nfs_icache_charge(NFS_BLKS_SZ(1));
+        }
+    }
+    return inode;
+
+err:
+    NFS_DBG("[%s] read inode %d failed\n", __func__, ino);
+    nfs_icache_free(inode);   // 销毁锁、释放已读入的目录项、extent表和数据块指针，并归还内存计数
+    return NULL;
+}
+
+/**
+ * @brief 获取目录项对应的内存inode，尚未读入或已被淘汰时从磁盘读取，并标记为最近访问过
+ * 多个线程同时读取同一个inode时只有一个线程真正读盘。
+ * 返回的inode可能随时被inode缓存淘汰，调用者需处于epoch临界区内、持有日志读锁或持有句柄
+ * 
+ * @param dentry 
+ * @return struct nfs_inode* 
+ */
+struct nfs_inode* nfs_dentry_inode(struct nfs_dentry* dentry) {
+    struct nfs_inode* inode = __atomic_load_n(&dentry->inode, __ATOMIC_ACQUIRE);
+    if (inode == NULL) {
+        pthread_mutex_lock(&nfs_super.load_lock);
+        inode = dentry->inode;
+        if (inode == NULL) {
+            inode = nfs_read_inode(dentry, dentry->ino);
+            if (inode != NULL) {
+                nfs_icache_add(inode);
             }
+            __atomic_store_n(&dentry->inode, inode, __ATOMIC_RELEASE);
         }
+        pthread_mutex_unlock(&nfs_super.load_lock);
+    }
+    else if (!NFS_LOAD(inode->referenced)) {
+        NFS_STORE(inode->referenced, 1);
     }
     return inode;
 }
@@ -368,7 +1235,7 @@ struct nfs_inode* nfs_read_inode(struct nfs_dentry * dentry, int ino) {
  * @return struct nfs_dentry* 
  */
 struct nfs_dentry* nfs_get_dentry(struct nfs_inode * inode, int dir) {
-    struct nfs_dentry* dentry_cursor = inode->dentrys;
+    struct nfs_dentry* dentry_cursor = NFS_LOAD(inode->dentrys);
     int    cnt = 0;
     while (dentry_cursor)
     {
@@ -376,7 +1243,7 @@ struct nfs_dentry* nfs_get_dentry(struct nfs_inode * inode, int dir) {
             return dentry_cursor;
         }
         cnt++;
-        dentry_cursor = dentry_cursor->brother;
+        dentry_cursor = NFS_LOAD(dentry_cursor->brother);
     }
     return NULL;
 }
@@ -403,36 +1270,40 @@ struct nfs_dentry* nfs_get_dentry(struct nfs_inode * inode, int dir) {
  *      3) find a's inode     lvl = 2
  *      4) find b's dentry    如果此时找不到了，is_find=FALSE且返回的是a的inode对应的dentry
  * 
+ * 路径上的inode读入失败(IO错误或内存不足)时is_find=FALSE且返回NULL
+ * 
  * @param path 
  * @return struct nfs_dentry* 
  */
 struct nfs_dentry* nfs_lookup(const char * path, boolean* is_find, boolean* is_root) {
     struct nfs_dentry* dentry_cursor = nfs_super.root_dentry;   // 路径解析从根目录开始
     struct nfs_dentry* dentry_ret = NULL;   // 当前查找到的目录或文件
+    struct nfs_dentry* sub_dentry;
     struct nfs_inode*  inode; 
     int   total_lvl = nfs_calc_lvl(path);
     int   lvl = 0;
-    boolean is_hit;
     char* fname = NULL;
-    char* path_cpy = (char*)malloc(sizeof(path));   // 当前路径的复制
+    char* save_ptr = NULL;
+    char* path_cpy = strdup(path);   // 当前路径的复制
+    *is_find = FALSE;
     *is_root = FALSE;
-    strcpy(path_cpy, path);
 
     if (total_lvl == 0) {                           /* 查找的是根目录 */
         *is_find = TRUE;
         *is_root = TRUE;
         dentry_ret = nfs_super.root_dentry;
     }
-    fname = strtok(path_cpy, "/");   // 分隔路径，获取最外层（最左侧）目录名    
+    nfs_epoch_enter();   // 逐层查找不加锁，期间读到的哈希索引不会被释放
+    fname = strtok_r(path_cpy, "/", &save_ptr);   // 分隔路径，获取最外层（最左侧）目录名    
     while (fname)
     {   
         lvl++;
-        if (dentry_cursor->inode == NULL) {           /* Cache机制 */
-            nfs_read_inode(dentry_cursor, dentry_cursor->ino);
+        inode = nfs_dentry_inode(dentry_cursor);           /* Cache机制 */
+        if (inode == NULL) {   // 被淘汰后重新读入失败
+            dentry_ret = NULL;
+            break;
         }
 
-        inode = dentry_cursor->inode;
-
         // 没遍历到目标层数就查询到普通文件，报错
         if (NFS_IS_REG(inode) && lvl < total_lvl) {
             NFS_DBG("[%s] not a dir\n", __func__);
@@ -440,41 +1311,400 @@ struct nfs_dentry* nfs_lookup(const char * path, boolean* is_find, boolean* is_r
             break;
         }
         if (NFS_IS_DIR(inode)) {
-            dentry_cursor = inode->dentrys;
-            is_hit        = FALSE;
-
-            while (dentry_cursor)   /* 遍历子目录项 */
-            {
-                if (memcmp(dentry_cursor->name, fname, strlen(fname)) == 0) {
-                    is_hit = TRUE;
-                    break;
-                }
-                dentry_cursor = dentry_cursor->brother;
-            }
+            sub_dentry = nfs_dir_lookup(inode, fname);   /* 通过哈希索引查找子目录项，与创建并发时结果为创建前或创建后 */
             
-            if (!is_hit) {
+            if (sub_dentry == NULL) {
                 *is_find = FALSE;
                 NFS_DBG("[%s] not found %s\n", __func__, fname);
                 dentry_ret = inode->dentry;   // 返回上一个有效路径
                 break;
             }
 
-            if (is_hit && lvl == total_lvl) {
+            dentry_cursor = sub_dentry;
+            if (lvl == total_lvl) {
                 *is_find = TRUE;
                 dentry_ret = dentry_cursor;   // 查找成功，返回该目录项
                 break;
             }
         }
-        fname = strtok(NULL, "/");   // 继续获取下一层目录名
+        fname = strtok_r(NULL, "/", &save_ptr);   // 继续获取下一层目录名
     }
 
-    if (dentry_ret->inode == NULL) {
-        dentry_ret->inode = nfs_read_inode(dentry_ret, dentry_ret->ino);
+    if (dentry_ret != NULL && nfs_dentry_inode(dentry_ret) == NULL) {
+        *is_find   = FALSE;
+        dentry_ret = NULL;
     }
+    nfs_epoch_exit();   // 调用者需处于epoch临界区内或持有日志读锁，返回的目录项才不会被inode缓存回收
 
+    free(path_cpy);
     return dentry_ret;
 }
 
+/**
+ * @brief 读入普通文件的第blk_no个数据块，只持有inode读锁时也可以调用
+ * 读取前nfs_readahead已把需要的块成批读入块缓存，这里通常直接从块缓存复制。
+ * 多个读者同时读入同一个块时只发布一个缓冲区，其余的丢弃
+ * 
+ * @param inode 普通文件的inode
+ * @param blk_no 文件内的逻辑块号，需小于block_num
+ * @return uint8_t* 内存不足或读失败时返回NULL
+ */
+static uint8_t* nfs_inode_fault(struct nfs_inode* inode, int blk_no) {
+    struct nfs_extent* ext;
+    uint8_t*           block;
+    uint8_t*           expected = NULL;
+    int                off = blk_no;
+    int                start = -1;
+
+    for (int i = 0; i < inode->extent_num; i++) {
+        ext = &inode->extents[i];
+        if (off < ext->len) {
+            start = ext->start + off;
+            break;
+        }
+        off -= ext->len;
+    }
+    if (start < 0 || (block = (uint8_t *)malloc(NFS_BLKS_SZ(1))) == NULL) {
+        return NULL;
+    }
+    if (nfs_driver_read(NFS_DATA_OFS(start), block, NFS_BLKS_SZ(1)) != NFS_ERROR_NONE) {
+        NFS_DBG("[%s] io error\n", __func__);
+        free(block);
+        return NULL;
+    }
+    if (!__atomic_compare_exchange_n(&inode->block_pointer[blk_no], &expected, block, FALSE,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        free(block);   // 其他读者已经读入
+        return expected;
+    }
+    nfs_icache_charge(NFS_BLKS_SZ(1));
+    if (!NFS_LOAD(inode->referenced)) {
+        NFS_STORE(inode->referenced, 1);
+    }
+    return block;
+}
+
+/**
+ * @brief 获取普通文件第blk_no个数据块在内存中的指针，尚未读入或已被inode缓存丢弃时从磁盘读入
+ * 内嵌文件只有第0块，即内存中的内嵌内容，超出内嵌大小的写入需先调用nfs_inode_expand
+ * create为FALSE时只需持有inode读锁，否则需持有写锁
+ * 
+ * @param inode 普通文件的inode
+ * @param blk_no 文件内的逻辑块号
+ * @param create 数据块不存在时是否分配(中间未分配的数据块一并分配并清零)
+ * @return uint8_t* 数据块不存在且不分配，或没有空间时返回NULL
+ */
+uint8_t* nfs_inode_block(struct nfs_inode* inode, int blk_no, boolean create) {
+    int      old_num = inode->block_num;
+    uint8_t* block;
+
+    if (blk_no < inode->block_num) {
+        block = NFS_LOAD(inode->block_pointer[blk_no]);
+        return block != NULL ? block : nfs_inode_fault(inode, blk_no);
+    }
+    if (NFS_IS_INLINE(inode) && blk_no == 0) {
+        if (inode->block_cap > 0 && inode->block_pointer[0] != NULL) {
+            return inode->block_pointer[0];
+        }
+        if (!create || nfs_inode_reserve(inode, 1) != NFS_ERROR_NONE
+            || (block = (uint8_t *)calloc(1, NFS_BLKS_SZ(1))) == NULL) {
+            return NULL;
+        }
+        nfs_icache_charge(NFS_BLKS_SZ(1));
+        NFS_STORE(inode->block_pointer[0], block);
+        return block;
+    }
+    if (!create) {
+        return NULL;
+    }
+    if (nfs_inode_reserve(inode, blk_no + 1) != NFS_ERROR_NONE
+        || nfs_inode_extend(inode, blk_no + 1 - old_num) != NFS_ERROR_NONE) {
+        return NULL;
+    }
+    for (int i = old_num; i <= blk_no; i++) {
+        inode->block_pointer[i] = (uint8_t *)calloc(1, NFS_BLKS_SZ(1));
+        if (inode->block_pointer[i] == NULL) {
+            nfs_inode_shrink(inode, old_num);
+            return NULL;
+        }
+        nfs_icache_charge(NFS_BLKS_SZ(1));
+        nfs_inode_dirty_block(inode, i);
+    }
+    return inode->block_pointer[blk_no];
+}
+
+/**
+ * @brief 文件将增长到size时，若超出内嵌大小则把内嵌内容迁移到新分配的第0个数据块，调用者需持有inode写锁
+ * 迁移后inode槽中不再保存内容，已在内存中的内嵌内容成为第0块的缓冲区
+ * 
+ * @param inode 普通文件的inode
+ * @param size 增长后的文件大小
+ * @return int 
+ */
+int nfs_inode_expand(struct nfs_inode* inode, int size) {
+    uint8_t* block;
+
+    if (!NFS_IS_INLINE(inode) || size <= NFS_INLINE_MAX) {
+        return NFS_ERROR_NONE;
+    }
+    if (nfs_inode_block(inode, 0, TRUE) == NULL) {   // 空文件还没有内嵌缓冲区
+        return -NFS_ERROR_NOMEM;
+    }
+    block = inode->block_pointer[0];
+    inode->block_pointer[0] = NULL;   // 分配期间失败时nfs_inode_shrink不会释放它
+    if (nfs_inode_extend(inode, 1) != NFS_ERROR_NONE) {
+        inode->block_pointer[0] = block;
+        return -NFS_ERROR_NOSPACE;
+    }
+    inode->block_pointer[0] = block;
+    nfs_inode_dirty_block(inode, 0);
+    nfs_inode_dirty(inode, NFS_INODE_DIRTY_META);
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 改变普通文件的大小，缩小时释放多余的数据块，扩大时分配清零的数据块
+ * 
+ * @param inode 普通文件的inode
+ * @param size 新的文件大小
+ * @return int 
+ */
+int nfs_inode_truncate(struct nfs_inode* inode, int size) {
+    int      blk_cnt = NFS_ROUND_UP(size, NFS_BLKS_SZ(1)) / NFS_BLKS_SZ(1);   // 新大小需要的数据块数量
+    int      bias    = size % NFS_BLKS_SZ(1);
+    uint8_t* block;
+
+    if (nfs_inode_expand(inode, size) != NFS_ERROR_NONE) {
+        return -NFS_ERROR_NOSPACE;
+    }
+    if (blk_cnt > inode->block_num) {
+        if (nfs_inode_block(inode, blk_cnt - 1, TRUE) == NULL) {
+            return -NFS_ERROR_NOSPACE;
+        }
+    }
+    nfs_inode_shrink(inode, blk_cnt);
+    // 最后一个数据块中超出新大小的部分清零，保证之后扩大文件时读到的是0
+    if (bias != 0 && size < inode->size) {
+        if ((block = nfs_inode_block(inode, blk_cnt - 1, FALSE)) == NULL) {
+            return -NFS_ERROR_IO;
+        }
+        memset(block + bias, 0, NFS_BLKS_SZ(1) - bias);
+        nfs_inode_dirty_block(inode, blk_cnt - 1);
+    }
+    NFS_STORE(inode->size, size);
+    nfs_inode_touch(inode, NFS_TIME_MTIME | NFS_TIME_CTIME, NULL);
+    return NFS_ERROR_NONE;
+}
+
+/**
+ * @brief 从offset处写入普通文件，数据块按需分配并标记为脏，调用者需已调用nfs_journal_begin并持有inode写锁
+ * 
+ * @param inode 普通文件的inode
+ * @param buf 写入的内容
+ * @param size 写入的字节数
+ * @param offset 相对文件的偏移
+ * @return int 写入大小，一个字节也没有写入时返回错误号
+ */
+int nfs_inode_write(struct nfs_inode* inode, const char* buf, size_t size, off_t offset) {
+    uint8_t* block;
+    int      blk_no, bias, len;
+    int      done = 0;
+
+    if (offset + size > INT_MAX) {   // 文件大小以int记录
+        return -NFS_ERROR_FBIG;
+    }
+    if (offset + size > inode->size && nfs_inode_expand(inode, offset + size) != NFS_ERROR_NONE) {
+        return -NFS_ERROR_NOSPACE;   // 内嵌文件无法迁移到数据块
+    }
+    while (done < size) {
+        blk_no = (offset + done) / NFS_BLKS_SZ(1);
+        bias   = (offset + done) % NFS_BLKS_SZ(1);
+        len    = NFS_BLKS_SZ(1) - bias < size - done ? NFS_BLKS_SZ(1) - bias : size - done;
+        block  = nfs_inode_block(inode, blk_no, TRUE);
+        if (block == NULL) {
+            break;
+        }
+        memcpy(block + bias, buf + done, len);
+        nfs_inode_dirty_block(inode, blk_no);
+        done += len;
+    }
+    if (offset + done > inode->size) {
+        NFS_STORE(inode->size, (int)(offset + done));   // getattr不加锁读取size
+    }
+    if (done > 0) {
+        nfs_inode_touch(inode, NFS_TIME_MTIME | NFS_TIME_CTIME, NULL);
+    }
+    return done == 0 && size != 0 ? -NFS_ERROR_NOSPACE : done;
+}
+
+/**
+ * @brief 从offset处读取普通文件，数据块按需读入，顺序读时预读之后的块，调用者需持有inode读锁
+ * 
+ * @param inode 普通文件的inode
+ * @param fh 打开文件的句柄，用于检测顺序读，可以为NULL
+ * @param buf 读取的内容
+ * @param size 读取的字节数
+ * @param offset 相对文件的偏移
+ * @return int 读取大小，读到文件末尾时可能小于size
+ */
+int nfs_inode_read(struct nfs_inode* inode, struct nfs_fhandle* fh, char* buf, size_t size, off_t offset) {
+    uint8_t* block;
+    int      blk_no, bias, len;
+    int      done = 0;
+
+    if (offset >= inode->size) {
+        return 0;
+    }
+    if (offset + size > inode->size) {
+        size = inode->size - offset;
+    }
+    nfs_readahead(inode, fh, offset, size);
+    while (done < size) {
+        blk_no = (offset + done) / NFS_BLKS_SZ(1);
+        bias   = (offset + done) % NFS_BLKS_SZ(1);
+        len    = NFS_BLKS_SZ(1) - bias < size - done ? NFS_BLKS_SZ(1) - bias : size - done;
+        block  = nfs_inode_block(inode, blk_no, FALSE);   // 数据块按需读入
+        if (block == NULL) {
+            return -NFS_ERROR_IO;
+        }
+        memcpy(buf + done, block + bias, len);
+        done += len;
+    }
+    return done;
+}
+
+/**
+ * @brief 与nfs_inode_read相同，但不复制内容，iov依次指向数据块中的对应部分，用于直接回复内核
+ * 调用者需持有inode读锁直到iov使用完毕，期间数据块不会被丢弃或替换
+ * 
+ * @param inode 普通文件的inode
+ * @param fh 打开文件的句柄，用于检测顺序读，可以为NULL
+ * @param iov 存放结果，容量至少为size / NFS_BLKS_SZ(1) + 2(首尾不对齐时各多跨一个块)
+ * @param size 读取的字节数
+ * @param offset 相对文件的偏移
+ * @return int iov的项数，读到文件末尾时为0
+ */
+int nfs_inode_read_iov(struct nfs_inode* inode, struct nfs_fhandle* fh, struct iovec* iov, size_t size, off_t offset) {
+    uint8_t* block;
+    int      blk_no, bias, len;
+    int      done = 0, n = 0;
+
+    if (offset >= inode->size) {
+        return 0;
+    }
+    if (offset + size > inode->size) {
+        size = inode->size - offset;
+    }
+    nfs_readahead(inode, fh, offset, size);
+    while (done < size) {
+        blk_no = (offset + done) / NFS_BLKS_SZ(1);
+        bias   = (offset + done) % NFS_BLKS_SZ(1);
+        len    = NFS_BLKS_SZ(1) - bias < size - done ? NFS_BLKS_SZ(1) - bias : size - done;
+        block  = nfs_inode_block(inode, blk_no, FALSE);   // 数据块按需读入
+        if (block == NULL) {
+            return -NFS_ERROR_IO;
+        }
+        iov[n].iov_base = block + bias;
+        iov[n].iov_len  = len;
+        n++;
+        done += len;
+    }
+    return n;
+}
+
+/**
+ * @brief 修改访问时间和修改时间，inode修改时间同时更新为当前时间，调用者需持有inode写锁
+ * 
+ * @param inode 
+ * @param tv tv[0]为访问时间，tv[1]为修改时间，可以为UTIME_NOW/UTIME_OMIT；tv为NULL表示都设为当前时间
+ */
+void nfs_inode_utimens(struct nfs_inode* inode, const struct timespec tv[2]) {
+    int flags[2] = { NFS_TIME_ATIME, NFS_TIME_MTIME };
+
+    for (int i = 0; i < 2; i++) {
+        if (tv == NULL || tv[i].tv_nsec == UTIME_NOW) {
+            nfs_inode_touch(inode, flags[i], NULL);
+        }
+        else if (tv[i].tv_nsec != UTIME_OMIT) {
+            nfs_inode_touch(inode, flags[i], &tv[i]);
+        }
+    }
+    nfs_inode_touch(inode, NFS_TIME_CTIME, NULL);
+}
+
+/**
+ * @brief 增加目录项对应inode的引用计数，之后inode不会被淘汰
+ * 先加引用计数再确认inode仍挂在目录项上，与nfs_icache_detach的先摘下再检查引用计数相对
+ * 
+ * @param dentry 目录项，调用者需处于epoch临界区内
+ * @return struct nfs_inode* 读入失败时返回NULL，inode已被淘汰时返回-NFS_ERROR_AGAIN，调用者需重新查找
+ */
+struct nfs_inode* nfs_inode_get(struct nfs_dentry* dentry) {
+    struct nfs_inode* inode = nfs_dentry_inode(dentry);
+
+    if (inode == NULL) {
+        return NULL;
+    }
+    __atomic_add_fetch(&inode->ref, 1, __ATOMIC_SEQ_CST);
+    if (NFS_LOAD(dentry->detached) || __atomic_load_n(&dentry->inode, __ATOMIC_SEQ_CST) != inode) {
+        __atomic_sub_fetch(&inode->ref, 1, __ATOMIC_SEQ_CST);
+        return (struct nfs_inode*)-NFS_ERROR_AGAIN;
+    }
+    return inode;
+}
+
+/**
+ * @brief 减少inode的引用计数，降为0后inode可以被淘汰
+ * 
+ * @param inode 
+ * @param n 减少的引用数
+ */
+void nfs_inode_put(struct nfs_inode* inode, int n) {
+    __atomic_sub_fetch(&inode->ref, n, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * @brief 为已找到的目录项创建句柄，并增加其inode的引用计数，之后inode不会被淘汰
+ * 
+ * @param dentry 目录项，调用者需处于epoch临界区内
+ * @return struct nfs_fhandle* inode已被淘汰时返回-NFS_ERROR_AGAIN，调用者需重新解析路径
+ */
+struct nfs_fhandle* nfs_fhandle_get(struct nfs_dentry* dentry) {
+    struct nfs_inode*   inode = nfs_inode_get(dentry);
+    struct nfs_fhandle* fh;
+
+    if (inode == NULL || inode == (struct nfs_inode*)-NFS_ERROR_AGAIN) {
+        return (struct nfs_fhandle*)inode;
+    }
+    fh = (struct nfs_fhandle*)malloc(sizeof(struct nfs_fhandle));
+    if (fh == NULL) {
+        nfs_inode_put(inode, 1);
+        return NULL;
+    }
+    fh->dentry  = dentry;
+    fh->inode   = inode;
+    fh->pos     = 0;
+    fh->next    = NFS_LOAD(inode->dentrys);
+    fh->ra_next = 0;
+    fh->ra_win  = 0;
+    fh->ra_end  = 0;
+    fh->wb_err  = NFS_LOAD(nfs_super.wb_err);   // 只报告打开之后发生的写回失败
+    return fh;
+}
+
+/**
+ * @brief 释放句柄，并减少其inode的引用计数
+ * 
+ * @param fh 
+ */
+void nfs_fhandle_put(struct nfs_fhandle* fh) {
+    if (fh == NULL) {
+        return;
+    }
+    nfs_inode_put(fh->inode, 1);
+    free(fh);
+}
+
 /**
  * @brief 挂载nfs, Layout 如下
  * 
@@ -483,7 +1713,7 @@ struct nfs_dentry* nfs_lookup(const char * path, boolean* is_find, boolean* is_r
  * 
  * BLK_SZ = 2 * IO_SZ
  * 
- * 8个Inode占用一个Blk
+ * 4个Inode占用一个Blk
  * @param options 
  * @return int 
  */
@@ -501,6 +1731,14 @@ int nfs_mount(struct custom_options options){
     boolean             is_init = FALSE;
 
     nfs_super.is_mounted = FALSE;
+    nfs_super.dirty_inodes = NULL;
+    nfs_super.dirty_tail   = NULL;
+    nfs_super.dirty_blks   = 0;
+    nfs_super.dirty_bg     = INT_MAX;   // 挂载完成、后台写回线程启动之前不唤醒
+    nfs_super.flusher_on   = FALSE;
+    pthread_mutex_init(&nfs_super.bm_lock, NULL);
+    pthread_mutex_init(&nfs_super.dirty_lock, NULL);
+    pthread_mutex_init(&nfs_super.load_lock, NULL);
 
     // driver_fd = open(options.device, O_RDWR);
     driver_fd = ddriver_open(options.device);   // 打开驱动
@@ -514,16 +1752,42 @@ int nfs_mount(struct custom_options options){
     ddriver_ioctl(NFS_DRIVER(), IOC_REQ_DEVICE_SIZE,  &nfs_super.sz_disk);
     ddriver_ioctl(NFS_DRIVER(), IOC_REQ_DEVICE_IO_SZ, &nfs_super.sz_io);
     nfs_super.sz_blks = nfs_super.sz_io * 2;
+
+    // 初始化块缓存，之后的nfs_driver_read/nfs_driver_write都经过块缓存
+    if (nfs_bcache_init(NFS_BUF_NUM) != NFS_ERROR_NONE) {
+        ddriver_close(driver_fd);
+        return -NFS_ERROR_NOSPACE;
+    }
+    nfs_dcache_init(options.dcache_size);   // 初始化路径缓存
+    nfs_icache_init(options.mem_limit);   // 初始化inode缓存
+    nfs_slab_init(&nfs_super.dentry_slab, "dentry", sizeof(struct nfs_dentry));
+    nfs_slab_init(&nfs_super.inode_slab, "inode", sizeof(struct nfs_inode));
     
     // 创建根目录项并读取磁盘超级块到内存
-    root_dentry = new_dentry("/", NFS_DIR);     /* 根目录项每次挂载时新建 */
+    nfs_super.root_dentry = NULL;
+    nfs_super.map_inode   = NULL;
+    nfs_super.map_data    = NULL;
+    root_dentry = new_dentry(NULL, "/", NFS_DIR);     /* 根目录项每次挂载时新建 */
+    if (root_dentry == NULL) {
+        ret = -NFS_ERROR_NOMEM;
+        goto err_cache;
+    }
+    nfs_super.root_dentry = root_dentry;   // 挂载失败时随inode缓存一起释放
 
     if (nfs_driver_read(NFS_SUPER_OFS, (uint8_t *)(&nfs_super_d),    // 由于固定从NFS_SUPER_OFS中读取超级块信息，故nfs_super_d不需存储超级块位于磁盘中的逻辑块数和偏移
                         sizeof(struct nfs_super_d)) != NFS_ERROR_NONE) {
-        return -NFS_ERROR_IO;
+        ret = -NFS_ERROR_IO;
+        goto err_cache;
     }   
                                                       /* 读取super */
-    if (nfs_super_d.magic_num != NFS_MAGIC_NUM) {     /* 幻数不正确，初始化 */
+    if (nfs_super_d.magic_num == NFS_MAGIC_NUM && nfs_super_d.version != NFS_LAYOUT_VERSION) {
+        // 本文件系统的旧格式，不能按新格式解释，也不自动格式化以免丢失数据
+        printf("nfs: %s has layout version %u, this build uses %d; "
+               "reset the device to reformat it\n", options.device, nfs_super_d.version, NFS_LAYOUT_VERSION);
+        ret = -NFS_ERROR_INVAL;
+        goto err_cache;
+    }
+    if (nfs_super_d.magic_num != NFS_MAGIC_NUM) {     /* 空白或其他文件系统的磁盘，初始化 */
                                                       /* 估算各部分大小 */
         super_blks = NFS_SUPER_BLOCK_NUM;   // 超级块占用逻辑块数量
 
@@ -532,8 +1796,9 @@ int nfs_mount(struct custom_options options){
         map_inode_blks = NFS_INODE_MAP_BLOCK_NUM;   // 索引节点位图占用逻辑块数量
                                                       /* 布局layout */
         // 先填充nfs_super_d，后赋值给nfs_super
-        nfs_super_d.max_ino = inode_block_num * 8;    // inode数目(一个逻辑块放置8个索引节点)
+        nfs_super_d.max_ino = inode_block_num * NFS_INODE_PER_BLK;    // inode数目(一个逻辑块放置NFS_INODE_PER_BLK个索引节点)
         nfs_super_d.magic_num = NFS_MAGIC_NUM;   // 幻数
+        nfs_super_d.version = NFS_LAYOUT_VERSION;   // 磁盘格式版本
         nfs_super_d.max_data = NFS_DATA_BLOCK_NUM;   // 数据块数量 
 
         nfs_super_d.map_inode_offset = NFS_SUPER_OFS + NFS_BLKS_SZ(super_blks);   // inode位图起始地址
@@ -543,7 +1808,9 @@ int nfs_mount(struct custom_options options){
         nfs_super_d.map_data_blks = NFS_DATA_MAP_BLOCK_NUM;   // 数据块位图所占逻辑块数量
 
         nfs_super_d.inode_offset = nfs_super_d.map_data_offset + NFS_BLKS_SZ(nfs_super_d.map_data_blks);   // 索引节点块起始地址
-        nfs_super_d.data_offset = nfs_super_d.inode_offset + NFS_BLKS_SZ(inode_block_num);   // 数据块起始地址
+        nfs_super_d.journal_offset = nfs_super_d.inode_offset + NFS_BLKS_SZ(inode_block_num);   // 日志区起始地址
+        nfs_super_d.journal_blks = NFS_JOURNAL_BLOCK_NUM;   // 日志区所占逻辑块数量
+        nfs_super_d.data_offset = nfs_super_d.journal_offset + NFS_BLKS_SZ(nfs_super_d.journal_blks);   // 数据块起始地址
 
         nfs_super_d.sz_usage    = 0;
         NFS_DBG("inode map blocks: %d\n", map_inode_blks);
@@ -552,7 +1819,7 @@ int nfs_mount(struct custom_options options){
     nfs_super.sz_usage   = nfs_super_d.sz_usage;      /* 建立 in-memory 结构 */
     nfs_super.magic = nfs_super_d.magic_num;
 
-    nfs_super.map_inode = (uint8_t *)malloc(NFS_BLKS_SZ(nfs_super_d.map_inode_blks));
+    nfs_super.map_inode = (uint8_t *)malloc(NFS_BLKS_SZ(nfs_super_d.map_inode_blks));   // 挂载失败时释放
     nfs_super.map_inode_blks = nfs_super_d.map_inode_blks;
     nfs_super.map_inode_offset = nfs_super_d.map_inode_offset;
     nfs_super.max_ino = nfs_super_d.max_ino;
@@ -569,32 +1836,87 @@ int nfs_mount(struct custom_options options){
 
 	printf("\n--------------------------------------------------------------------------------\n\n");
 
-    // 初始化inode位图
-    if (nfs_driver_read(nfs_super_d.map_inode_offset, (uint8_t *)(nfs_super.map_inode), 
-                        NFS_BLKS_SZ(nfs_super_d.map_inode_blks)) != NFS_ERROR_NONE) {
-        return -NFS_ERROR_IO;
+    // 格式化时清空日志，否则先重放日志，之后读到的位图和inode表才是最新的
+    if (nfs_journal_init(NFS_BLK_NO(nfs_super_d.journal_offset), nfs_super_d.journal_blks, is_init) != NFS_ERROR_NONE) {
+        ret = -NFS_ERROR_IO;
+        goto err_journal;
     }
 
-    // 初始化数据块位图
-    if (nfs_driver_read(nfs_super_d.map_data_offset, (uint8_t *)(nfs_super.map_data), 
-                        NFS_BLKS_SZ(nfs_super_d.map_data_blks)) != NFS_ERROR_NONE) {
-        return -NFS_ERROR_IO;
+    if (is_init) {   // 重新格式化时磁盘上可能残留旧格式的位图，直接清零
+        memset(nfs_super.map_inode, 0, NFS_BLKS_SZ(nfs_super_d.map_inode_blks));
+        memset(nfs_super.map_data, 0, NFS_BLKS_SZ(nfs_super_d.map_data_blks));
     }
+    else {
+        // 初始化inode位图
+        if (nfs_driver_read(nfs_super_d.map_inode_offset, (uint8_t *)(nfs_super.map_inode), 
+                            NFS_BLKS_SZ(nfs_super_d.map_inode_blks)) != NFS_ERROR_NONE) {
+            ret = -NFS_ERROR_IO;
+            goto err_journal;
+        }
+
+        // 初始化数据块位图
+        if (nfs_driver_read(nfs_super_d.map_data_offset, (uint8_t *)(nfs_super.map_data), 
+                            NFS_BLKS_SZ(nfs_super_d.map_data_blks)) != NFS_ERROR_NONE) {
+            ret = -NFS_ERROR_IO;
+            goto err_journal;
+        }
+    }
+
+    // 初始化位图分配器
+    nfs_bitmap_init(&nfs_super.inode_bm, nfs_super.map_inode, nfs_super.max_ino);
+    nfs_bitmap_init(&nfs_super.data_bm, nfs_super.map_data, nfs_super.max_data);
+    nfs_super.inode_bm.dirty = is_init;   // 格式化后的位图需要整体写回
+    nfs_super.data_bm.dirty  = is_init;
 
     if (is_init) {                                    /* 分配根节点 */
         root_inode = nfs_alloc_inode(root_dentry);
-        nfs_sync_inode(root_inode);
+        if (root_inode == (struct nfs_inode *)-NFS_ERROR_NOSPACE || root_inode == (struct nfs_inode *)-NFS_ERROR_NOMEM) {
+            ret = root_inode == (struct nfs_inode *)-NFS_ERROR_NOSPACE ? -NFS_ERROR_NOSPACE : -NFS_ERROR_NOMEM;
+            goto err_journal;
+        }
+        // 根目录和位图落盘后最后写超级块，中途崩溃时下次挂载会重新格式化
+        if (nfs_journal_commit(TRUE) < 0
+            || nfs_driver_write(NFS_SUPER_OFS, (uint8_t *)&nfs_super_d, 
+                                sizeof(struct nfs_super_d)) != NFS_ERROR_NONE
+            || nfs_bcache_sync() < 0) {
+            ret = -NFS_ERROR_IO;
+            goto err_journal;
+        }
+    }
+    else {
+        root_inode = nfs_read_inode(root_dentry, NFS_ROOT_INO);  /* 读取根目录 */
+        if (root_inode == NULL) {
+            ret = -NFS_ERROR_IO;
+            goto err_journal;
+        }
     }
     
-    // 初始化根目录项
-    root_inode            = nfs_read_inode(root_dentry, NFS_ROOT_INO);  /* 读取根目录 */
+    // 初始化根目录项，根目录常驻内存，不加入inode缓存的淘汰链表
     root_dentry->inode    = root_inode;
-    nfs_super.root_dentry = root_dentry;
     nfs_super.is_mounted  = TRUE;
 
+    nfs_flush_start(options.flush_interval, options.dirty_limit);   // 之后由后台线程写回脏数据
+    nfs_readahead_start(options.readahead);
+
     // nfs_dump_map();
 
     return ret;
+
+err_journal:
+    nfs_journal_destroy();
+    free(nfs_super.map_inode);
+    free(nfs_super.map_data);
+    nfs_super.map_inode = NULL;
+    nfs_super.map_data  = NULL;
+err_cache:   // 此时没有其他线程，按卸载的顺序释放已初始化的部分，块缓存中已写入的内容照常写回
+    nfs_dcache_destroy();
+    nfs_epoch_destroy();
+    nfs_icache_destroy();   // 释放根目录项及格式化时分配的根inode
+    nfs_slab_destroy(&nfs_super.dentry_slab);
+    nfs_slab_destroy(&nfs_super.inode_slab);
+    nfs_bcache_destroy();
+    ddriver_close(driver_fd);
+    return ret;
 }
 
 /**
@@ -603,51 +1925,32 @@ int nfs_mount(struct custom_options options){
  * @return int 
  */
 int nfs_umount() {
-    struct nfs_super_d  nfs_super_d; 
-
     if (!nfs_super.is_mounted) {
         return NFS_ERROR_NONE;
     }
 
-    nfs_sync_inode(nfs_super.root_dentry->inode);     /* 从根节点向下刷写节点，将其刷回磁盘 */
+    nfs_readahead_stop();   // 预读线程可能正在使用块缓存，先于块缓存销毁停止
+    nfs_flush_stop();   // 停止后台写回，剩余的脏数据在下面一次写回
+    nfs_dcache_destroy();   // 清空路径缓存
 
-    // 利用nfs_super字段填写nfs_super_d相关字段，并将nfs_super_d写入磁盘                                              
-    nfs_super_d.magic_num           = NFS_MAGIC_NUM;
-
-    nfs_super_d.max_ino             = nfs_super.max_ino;
-    nfs_super_d.max_data            = nfs_super.max_data;
-
-    nfs_super_d.map_inode_blks      = nfs_super.map_inode_blks;
-    nfs_super_d.map_data_blks       = nfs_super.map_data_blks;
-
-    nfs_super_d.map_inode_offset    = nfs_super.map_inode_offset;
-    nfs_super_d.map_data_offset     = nfs_super.map_data_offset;
-
-    nfs_super_d.inode_offset        = nfs_super.inode_offset;
-    nfs_super_d.data_offset         = nfs_super.data_offset;
-
-    nfs_super_d.sz_usage            = nfs_super.sz_usage;
-    
-    if (nfs_driver_write(NFS_SUPER_OFS, (uint8_t *)&nfs_super_d, 
-                     sizeof(struct nfs_super_d)) != NFS_ERROR_NONE) {
+    // 提交剩余的脏数据并做检查点，日志清空后下次挂载无需重放
+    if (nfs_journal_commit(TRUE) < 0) {
         return -NFS_ERROR_IO;
     }
+    nfs_journal_destroy();
 
-    // 将inode位图写入磁盘
-    if (nfs_driver_write(nfs_super_d.map_inode_offset, (uint8_t *)(nfs_super.map_inode), 
-                         NFS_BLKS_SZ(nfs_super_d.map_inode_blks)) != NFS_ERROR_NONE) {
-        return -NFS_ERROR_IO;
-    }
+    free(nfs_super.map_inode);   // 释放inode位图
+    free(nfs_super.map_data);   // 释放数据块位图
+    nfs_epoch_destroy();   // 释放等待回收的哈希索引、路径缓存条目和被淘汰的inode
+    nfs_icache_destroy();   // 释放整棵inode树
+    nfs_slab_destroy(&nfs_super.dentry_slab);
+    nfs_slab_destroy(&nfs_super.inode_slab);
 
-    // 将数据块位图写入磁盘
-    if (nfs_driver_write(nfs_super_d.map_data_offset, (uint8_t *)(nfs_super.map_data), 
-                         NFS_BLKS_SZ(nfs_super_d.map_data_blks)) != NFS_ERROR_NONE) {
+    // 将块缓存中的脏块写回磁盘
+    if (nfs_bcache_destroy() != NFS_ERROR_NONE) {
         return -NFS_ERROR_IO;
     }
 
-    free(nfs_super.map_inode);   // 释放inode位图
-    free(nfs_super.map_data);   // 释放数据块位图
-
     ddriver_close(NFS_DRIVER());   // 关闭驱动
 
     return NFS_ERROR_NONE;
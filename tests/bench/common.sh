@@ -0,0 +1,76 @@
+# 基准测试的公共部分，由tests/bench下的各脚本source，不单独执行
+# 挂载点、可执行文件和设备的路径只在这里维护，布局变化时只需修改本文件
+#
+# 用法: source "$(dirname "$0")"/common.sh
+#       脚本可以在调用mount_nfs前改写NFS_BIN(例如对比不同的编译版本)
+
+BENCH_DIR=$(cd "$(dirname "${BASH_SOURCE[0]}")"; pwd)
+SRC_DIR=$(cd "$BENCH_DIR/../.."; pwd)
+MNTPOINT="$BENCH_DIR/../mnt"
+NFS_BIN="$SRC_DIR/build/nfs"
+DEVICE="$HOME"/ddriver
+NFS_FG_PID=
+
+# 在后台挂载，额外的参数作为挂载选项
+function mount_nfs() {
+    "$NFS_BIN" --device="$DEVICE" "$@" "$MNTPOINT"
+}
+
+# 前台(-f)挂载并把输出写入日志$1，等待挂载完成，额外的参数作为挂载选项
+function mount_nfs_fg() {
+    local log=$1
+    shift
+    "$NFS_BIN" --device="$DEVICE" -f "$@" "$MNTPOINT" > "$log" 2>&1 &
+    NFS_FG_PID=$!
+    local i
+    for ((i = 0; i < 50; i++)); do
+        mountpoint -q "$MNTPOINT" && return 0
+        sleep 0.1
+    done
+    return 1
+}
+
+# 等待内核把请求处理完再卸载；前台挂载时等进程退出，保证日志写完整
+function umount_nfs() {
+    sleep 1
+    umount "$MNTPOINT"
+    if [ -n "$NFS_FG_PID" ]; then
+        wait "$NFS_FG_PID"
+        NFS_FG_PID=
+    fi
+}
+
+# 擦除ddriver，下次挂载时重新格式化
+function reset_ddriver() {
+    ddriver -r > /dev/null
+}
+
+# 编译到$SRC_DIR/$1，额外的参数传给cmake
+function build() {
+    cmake -S "$SRC_DIR" -B "$SRC_DIR/$1" "${@:2}" > /dev/null || exit 1
+    cmake --build "$SRC_DIR/$1" -j"$(nproc)" > /dev/null || exit 1
+}
+
+# 当前挂载的nfs进程号
+function nfs_pid() {
+    pgrep -n -f "$NFS_BIN --device=$DEVICE"
+}
+
+# 输出dd的吞吐(MB/s)
+function run_dd() {
+    LC_ALL=C dd "$@" bs=128k 2>&1 | awk '/copied/ {print $(NF-1)}'
+}
+
+# 输出stat $1共$ROUNDS次的平均延迟(us)
+function bench_stat() {
+    python3 - "$1" "$ROUNDS" <<'PYEOF'
+import os, sys, time
+path, rounds = sys.argv[1], int(sys.argv[2])
+start = time.perf_counter()
+for _ in range(rounds):
+    os.stat(path)
+print("%.2f" % ((time.perf_counter() - start) * 1e6 / rounds))
+PYEOF
+}
+
+mkdir -p "$MNTPOINT"
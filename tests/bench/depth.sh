@@ -0,0 +1,44 @@
+#!/bin/bash
+# 路径深度基准测试
+# 分别用低层接口(build/nfs)和高层接口(build_hl/nfs，cmake -DNFS_HIGH_LEVEL=ON)的版本，
+# 建立深度为D的目录链，关闭内核的属性及目录项缓存后测量stat各层末端文件的平均延迟，
+# 用于验证低层接口下每个操作的开销不随路径深度增长
+#
+# 用法: ./depth.sh [D]   (默认: 32)
+# 注意: 会先编译两个版本，并且会擦除ddriver
+
+source "$(dirname "$0")"/common.sh
+ROUNDS=2000
+D=${1:-32}
+LEVELS=(1 $((D / 4)) $((D / 2)) "$D")
+
+build build
+build build_hl -DNFS_HIGH_LEVEL=ON
+
+printf "%-12s" "api"
+for lvl in "${LEVELS[@]}"; do
+    printf "%-16s" "depth $lvl(us)"
+done
+printf "\n"
+for api in build build_hl; do
+    NFS_BIN="$SRC_DIR/$api/nfs"
+    reset_ddriver
+    # 关闭内核的属性及目录项缓存，保证每次stat都会到达文件系统
+    mount_nfs -o attr_timeout=0,entry_timeout=0,negative_timeout=0 || exit 1
+    DIR="$MNTPOINT"
+    for ((i = 1; i <= D; i++)); do
+        DIR="$DIR/d$i"
+        mkdir "$DIR"
+        touch "$DIR"/file
+    done
+    printf "%-12s" "$api"
+    for lvl in "${LEVELS[@]}"; do
+        FILE="$MNTPOINT"
+        for ((i = 1; i <= lvl; i++)); do
+            FILE="$FILE/d$i"
+        done
+        printf "%-16s" "$(bench_stat "$FILE"/file)"
+    done
+    printf "\n"
+    umount_nfs
+done
@@ -0,0 +1,46 @@
+#!/bin/bash
+# 写回合并测试
+# 在前台(-f)挂载并记录NFS_DBG输出，创建D个目录、每个目录F个小文件，再以乱序的偏移写入一个S KB的文件，
+# 从卸载时打印的块缓存统计中读出写回(nfs_bcache_sync_flags)的次数、块数、合并后的段数以及
+# 通过IOC_REQ_DEVICE_STATE得到的设备寻道/写次数，按块写回时每块寻道一次，块数即合并前的寻道次数
+#
+# 用法: ./flush.sh [D] [F] [S]   (默认: 8 16 1024)
+# 注意: 运行前需要先编译(build/nfs)，并且会擦除ddriver
+
+source "$(dirname "$0")"/common.sh
+LOG=$(mktemp)   # nfs在前台运行时的输出
+D=${1:-8}
+F=${2:-16}
+S=${3:-1024}
+
+reset_ddriver
+mount_nfs_fg "$LOG" || exit 1
+for ((d = 0; d < D; d++)); do
+    mkdir "$MNTPOINT"/d"$d"
+    for ((f = 0; f < F; f++)); do
+        head -c 3000 /dev/urandom > "$MNTPOINT"/d"$d"/f"$f"
+    done
+done
+python3 - "$MNTPOINT"/big "$S" <<'PYEOF'
+import os, random, sys
+path, kb = sys.argv[1], int(sys.argv[2])
+fd = os.open(path, os.O_WRONLY | os.O_CREAT, 0o644)
+os.ftruncate(fd, kb * 1024)
+blocks = list(range(kb))
+random.seed(1)
+random.shuffle(blocks)
+for b in blocks:
+    os.pwrite(fd, os.urandom(1024), b * 1024)
+os.fsync(fd)
+os.close(fd)
+PYEOF
+umount_nfs
+
+awk '
+/nfs_bcache_destroy\] sync:/ { syncs = $4; blks = $6; runs = $9 }
+/nfs_bcache_destroy\] device read/ { seek = $9 + 0; write = $7 + 0 }
+END {
+    printf "%-10s %-14s %-14s %-14s %-14s\n", "syncs", "blks", "runs", "device seek", "device write"
+    printf "%-10s %-14s %-14s %-14s %-14s\n", syncs, blks, runs, seek, write
+}' "$LOG"
+rm -f "$LOG"
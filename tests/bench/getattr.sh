@@ -0,0 +1,29 @@
+#!/bin/bash
+# getattr延迟基准测试
+# 在同一目录下创建N个文件，测量stat第一个和最后一个文件的平均延迟，
+# 用于验证目录哈希索引下getattr的延迟不随目录项数量增长
+#
+# 用法: ./getattr.sh [N ...]   (默认: 10 100 600)
+# 注意: 运行前需要先编译(build/nfs)，并且会擦除ddriver
+
+source "$(dirname "$0")"/common.sh
+ROUNDS=2000
+SIZES=("$@")
+if (( ${#SIZES[@]} == 0 )); then
+    SIZES=(10 100 600)
+fi
+
+printf "%-10s %-20s %-20s\n" "entries" "first(us/stat)" "last(us/stat)"
+for n in "${SIZES[@]}"; do
+    reset_ddriver
+    # 关闭内核的属性及目录项缓存，保证每次stat都会调用nfs_getattr
+    mount_nfs -o attr_timeout=0,entry_timeout=0,negative_timeout=0 || exit 1
+    mkdir "$MNTPOINT"/bench
+    for ((i = 0; i < n; i++)); do
+        touch "$MNTPOINT"/bench/file$i
+    done
+    FIRST=$(bench_stat "$MNTPOINT"/bench/file0)
+    LAST=$(bench_stat "$MNTPOINT"/bench/file$((n - 1)))
+    printf "%-10s %-20s %-20s\n" "$n" "$FIRST" "$LAST"
+    umount_nfs
+done
@@ -0,0 +1,35 @@
+#!/bin/bash
+# inode缓存内存预算测试
+# 创建D个目录、每个目录F个文件(每个文件S KB)，重新挂载后ls -lR并读出所有文件，
+# 记录nfs进程的峰值RSS(VmHWM)，用于验证不同--mem_limit下驻留内存不随访问过的文件数增长
+#
+# 用法: ./icache.sh [D] [F] [S]   (默认: 20 25 4，D * (F + 1)不能超过inode总数)
+# 注意: 运行前需要先编译(build/nfs)，并且会擦除ddriver
+
+source "$(dirname "$0")"/common.sh
+D=${1:-20}
+F=${2:-25}
+S=${3:-4}
+LIMITS=(0 1024 256)   # KB，0表示不限制
+
+reset_ddriver
+mount_nfs || exit 1
+for ((d = 0; d < D; d++)); do
+    mkdir "$MNTPOINT"/d"$d"
+    for ((f = 0; f < F; f++)); do
+        head -c $((S * 1024)) /dev/urandom > "$MNTPOINT"/d"$d"/f"$f"
+    done
+done
+umount_nfs
+
+printf "%-16s %-16s %-16s\n" "mem_limit(KB)" "ls -lR(ms)" "peak RSS(KB)"
+for limit in "${LIMITS[@]}"; do
+    mount_nfs --mem_limit="$limit" || exit 1
+    START=$(date +%s%N)
+    ls -lR "$MNTPOINT" > /dev/null
+    END=$(date +%s%N)
+    cat "$MNTPOINT"/d*/f* > /dev/null
+    RSS=$(awk '/VmHWM/ {print $2}' /proc/"$(nfs_pid)"/status)
+    printf "%-16s %-16s %-16s\n" "$limit" "$(( (END - START) / 1000000 ))" "$RSS"
+    umount_nfs
+done
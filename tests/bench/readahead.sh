@@ -0,0 +1,61 @@
+#!/bin/bash
+# 预读基准测试
+# 分别用关闭预读(--readahead=0)和默认挂载选项挂载，dd顺序写入一个S KB的文件并在一个目录下创建N个文件，
+# 重新挂载后测量顺序读吞吐、4KB随机读的平均延迟以及ls -l列出目录的耗时，
+# 用于验证顺序读和目录遍历受益于预读，而随机读不因预读变慢
+#
+# 用法: ./readahead.sh [S] [N]   (默认: 3072 500，S不能超过数据区大小)
+# 注意: 运行前需要先编译(build/nfs)，并且会擦除ddriver
+
+source "$(dirname "$0")"/common.sh
+S=${1:-3072}
+N=${2:-500}
+ROUNDS=1000
+
+# 输出4KB随机读的平均延迟(us)
+function bench_random() {
+    python3 - "$1" "$ROUNDS" <<'PYEOF'
+import os, random, sys, time
+path, rounds = sys.argv[1], int(sys.argv[2])
+fd = os.open(path, os.O_RDONLY)
+size = os.fstat(fd).st_size
+random.seed(1)
+offsets = [random.randrange(0, size - 4096) & ~4095 for _ in range(rounds)]
+start = time.perf_counter()
+for off in offsets:
+    os.pread(fd, 4096, off)
+print("%.2f" % ((time.perf_counter() - start) * 1e6 / rounds))
+os.close(fd)
+PYEOF
+}
+
+# 输出ls -l的耗时(ms)
+function bench_ls() {
+    local start end
+    start=$(date +%s%N)
+    ls -l "$1" > /dev/null
+    end=$(date +%s%N)
+    echo $(((end - start) / 1000000))
+}
+
+printf "%-12s %-16s %-16s %-16s\n" "readahead" "seq(MB/s)" "random(us/4KB)" "ls -l(ms)"
+for variant in "off:--readahead=0" "default:"; do
+    name=${variant%%:*}
+    read -r -a opts <<< "${variant#*:}"
+    reset_ddriver
+    mount_nfs "${opts[@]}" || exit 1
+    run_dd if=/dev/zero of="$MNTPOINT"/seq count=$((S / 128)) conv=fsync > /dev/null
+    mkdir "$MNTPOINT"/dir
+    for ((i = 0; i < N; i++)); do
+        touch "$MNTPOINT"/dir/file$i
+    done
+    umount_nfs
+    mount_nfs "${opts[@]}" || exit 1   # 重新挂载，读请求不会命中内核页缓存和块缓存
+    SEQ=$(run_dd if="$MNTPOINT"/seq of=/dev/null)
+    umount_nfs
+    mount_nfs "${opts[@]}" || exit 1
+    RANDOM_US=$(bench_random "$MNTPOINT"/seq)
+    LS=$(bench_ls "$MNTPOINT"/dir)
+    umount_nfs
+    printf "%-12s %-16s %-16s %-16s\n" "$name" "$SEQ" "$RANDOM_US" "$LS"
+done
@@ -0,0 +1,27 @@
+#!/bin/bash
+# 顺序读写吞吐测试
+# 分别用不协商连接参数(--max_write=0 --max_readahead=0，即内核默认的每次一页写请求)和
+# 默认挂载选项(big_writes、128KB写请求、async_read)挂载，dd顺序写入一个S KB的文件后重新挂载顺序读出，
+# 输出两种配置下的写、读吞吐
+#
+# 用法: ./seqio.sh [S] [额外的挂载选项 ...]   (默认: 3072，不能超过数据区大小)
+# 注意: 运行前需要先编译(build/nfs)，并且会擦除ddriver
+
+source "$(dirname "$0")"/common.sh
+S=${1:-3072}
+shift
+EXTRA=("$@")
+
+printf "%-12s %-16s %-16s\n" "conn" "write(MB/s)" "read(MB/s)"
+for variant in "default:--max_write=0 --max_readahead=0" "negotiated:"; do
+    name=${variant%%:*}
+    read -r -a opts <<< "${variant#*:}"
+    reset_ddriver
+    mount_nfs "${opts[@]}" "${EXTRA[@]}" || exit 1
+    WRITE=$(run_dd if=/dev/zero of="$MNTPOINT"/seq count=$((S / 128)) conv=fsync)
+    umount_nfs
+    mount_nfs "${opts[@]}" "${EXTRA[@]}" || exit 1   # 重新挂载，读请求不会命中内核页缓存
+    READ=$(run_dd if="$MNTPOINT"/seq of=/dev/null)
+    umount_nfs
+    printf "%-12s %-16s %-16s\n" "$name" "$WRITE" "$READ"
+done
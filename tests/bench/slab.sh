@@ -0,0 +1,55 @@
+#!/bin/bash
+# 对象池与malloc对比测试
+# 分别用对象池(build/nfs)和逐个malloc(build_malloc/nfs，cmake -DNFS_USE_MALLOC=ON)的版本，
+# 创建D个目录、每个目录F个空文件，测量创建吞吐；重新挂载后ls -lR，测量建树耗时；
+# 安装了perf时同时统计ls -lR期间nfs进程的cache-misses
+#
+# 用法: ./slab.sh [D] [F]   (默认: 20 25，D * (F + 1)不能超过inode总数)
+# 注意: 会先编译两个版本，并且会擦除ddriver
+
+source "$(dirname "$0")"/common.sh
+D=${1:-20}
+F=${2:-25}
+
+function bench_create() {
+    python3 - "$MNTPOINT" "$D" "$F" <<'PYEOF'
+import os, sys, time
+root, d, f = sys.argv[1], int(sys.argv[2]), int(sys.argv[3])
+start = time.perf_counter()
+for i in range(d):
+    os.mkdir("%s/d%d" % (root, i))
+    for j in range(f):
+        os.close(os.open("%s/d%d/f%d" % (root, i, j), os.O_CREAT | os.O_WRONLY, 0o644))
+print("%.0f" % (d * (f + 1) / (time.perf_counter() - start)))
+PYEOF
+}
+
+build build
+build build_malloc -DNFS_USE_MALLOC=ON
+printf "%-10s %-16s %-16s %-16s\n" "alloc" "create(ops/s)" "ls -lR(ms)" "cache-misses"
+for variant in slab:build malloc:build_malloc; do
+    NFS_BIN="$SRC_DIR/${variant#*:}/nfs"
+    reset_ddriver
+    mount_nfs || exit 1
+    OPS=$(bench_create)
+    umount_nfs
+
+    mount_nfs || exit 1
+    MISSES="-"
+    if command -v perf > /dev/null; then
+        perf stat -x, -e cache-misses -p "$(nfs_pid)" -o /tmp/nfs_slab_perf &
+        PERF_PID=$!
+        sleep 0.5
+    fi
+    START=$(date +%s%N)
+    ls -lR "$MNTPOINT" > /dev/null
+    END=$(date +%s%N)
+    if [ -n "$PERF_PID" ]; then
+        kill -INT "$PERF_PID"
+        wait "$PERF_PID"
+        MISSES=$(awk -F, '/cache-misses/ {print $1}' /tmp/nfs_slab_perf)
+        PERF_PID=
+    fi
+    printf "%-10s %-16s %-16s %-16s\n" "${variant%%:*}" "$OPS" "$(( (END - START) / 1000000 ))" "$MISSES"
+    umount_nfs
+done
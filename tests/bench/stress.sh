@@ -0,0 +1,126 @@
+#!/bin/bash
+# 多线程并发压力测试
+# FUSE默认以多线程方式运行，P个进程同时在各自的目录和同一个共享目录下创建文件，
+# 同时不停地ls共享目录，结束后检查:
+#   1. 每个目录的目录项个数(dir_cnt)没有丢失更新，且remount后保持一致
+#   2. 卸载后磁盘上的inode位图、数据块位图与inode表中实际引用的数据块完全一致
+#
+# 用法: ./stress.sh [P] [N]   (默认: 8 30，P * (2N + 1)不能超过inode总数)
+# 注意: 运行前需要先编译(build/nfs)，并且会擦除ddriver
+
+source "$(dirname "$0")"/common.sh
+P=${1:-8}
+N=${2:-30}
+
+function worker() {
+    local id=$1
+    mkdir "$MNTPOINT"/stress/d"$id" || return 1
+    for ((i = 0; i < N; i++)); do
+        touch "$MNTPOINT"/stress/d"$id"/f"$i" || return 1
+        touch "$MNTPOINT"/stress/shared"$id"_"$i" || return 1
+        if (( i % 8 == 0 )); then
+            echo "worker $id file $i" > "$MNTPOINT"/stress/shared"$id"_"$i" || return 1
+        fi
+    done
+}
+
+function check_counts() {
+    local fail=0
+    local cnt
+    cnt=$(ls "$MNTPOINT"/stress | wc -l)
+    if (( cnt != P + P * N )); then
+        echo "共享目录目录项个数错误: $cnt, 期望 $((P + P * N))"
+        fail=1
+    fi
+    for ((id = 0; id < P; id++)); do
+        cnt=$(ls "$MNTPOINT"/stress/d"$id" | wc -l)
+        if (( cnt != N )); then
+            echo "d$id 目录项个数错误: $cnt, 期望 $N"
+            fail=1
+        fi
+    done
+    return $fail
+}
+
+# 检查位图与inode表是否一致: 被占用的inode引用的数据块恰好就是数据块位图中被占用的块，且没有块被重复引用
+function check_bitmap() {
+    python3 - "$DEVICE" "$SRC_DIR"/include/types.h <<'PYEOF'
+import re, struct, sys
+disk = open(sys.argv[1], "rb").read()
+BLK = 1024
+(magic, usage, max_ino, map_inode_ofs, map_inode_blks, max_data, map_data_blks,
+ map_data_ofs, inode_ofs, data_ofs, version) = struct.unpack_from("<Iiiiiiiiiii", disk, 0)
+# inode槽大小和内嵌extent数量取自include/types.h，extent表之前的字段与struct nfs_inode_d一致(按本机对齐)
+TYPES = open(sys.argv[2]).read()
+INODE_SZ      = int(re.search(r"#define NFS_INODE_D_SZ\s+(\d+)", TYPES).group(1))
+EXTENT_INLINE = int(re.search(r"#define NFS_EXTENT_INLINE\s+(\d+)", TYPES).group(1))
+INODE_HEAD    = "Iiiiiii"                             # ino, size, dir_cnt, block_num, ftype, extent_num, extent_blk
+EXTENT_OFS    = struct.calcsize("@" + INODE_HEAD + "3I3q")   # 之后是时间戳的纳秒和秒
+
+def bit(ofs, i):
+    return (disk[ofs + i // 8] >> (i % 8)) & 1
+
+used = {}
+for ino in range(max_ino):
+    if not bit(map_inode_ofs, ino):
+        continue
+    base = inode_ofs + ino * INODE_SZ
+    _, size, dir_cnt, block_num, ftype, extent_num, extent_blk = struct.unpack_from("<" + INODE_HEAD, disk, base)
+    extents = [struct.unpack_from("<ii", disk, base + EXTENT_OFS + 8 * i) for i in range(min(extent_num, EXTENT_INLINE))]
+    if extent_num > EXTENT_INLINE:
+        used.setdefault(extent_blk, []).append(ino)
+        ofs = data_ofs + extent_blk * BLK
+        extents += [struct.unpack_from("<ii", disk, ofs + 8 * i) for i in range(extent_num - EXTENT_INLINE)]
+    if sum(l for _, l in extents) != block_num:
+        sys.exit("inode %d: extent总长度 %d != block_num %d" % (ino, sum(l for _, l in extents), block_num))
+    for start, length in extents:
+        for blk in range(start, start + length):
+            used.setdefault(blk, []).append(ino)
+
+err = 0
+for blk, inos in used.items():
+    if len(inos) > 1:
+        print("数据块 %d 被多个inode引用: %s" % (blk, inos)); err = 1
+    if not bit(map_data_ofs, blk):
+        print("数据块 %d 被inode %s 引用但位图中空闲" % (blk, inos)); err = 1
+for blk in range(max_data):
+    if bit(map_data_ofs, blk) and blk not in used:
+        print("数据块 %d 在位图中被占用但没有inode引用" % blk); err = 1
+inodes = sum(bit(map_inode_ofs, i) for i in range(max_ino))
+print("inode: %d, 数据块: %d" % (inodes, len(used)))
+sys.exit(err)
+PYEOF
+}
+
+reset_ddriver
+mount_nfs || exit 1
+mkdir "$MNTPOINT"/stress
+
+START=$(date +%s%N)
+pids=()
+for ((id = 0; id < P; id++)); do
+    worker "$id" &
+    pids+=($!)
+done
+( while kill -0 "${pids[0]}" 2> /dev/null; do ls "$MNTPOINT"/stress > /dev/null; done ) &
+FAIL=0
+for pid in "${pids[@]}"; do
+    wait "$pid" || FAIL=1
+done
+wait
+END=$(date +%s%N)
+echo "$P 个进程各创建 $((2 * N)) 个文件，耗时 $(( (END - START) / 1000000 )) ms"
+
+check_counts || FAIL=1
+umount_nfs
+check_bitmap || FAIL=1
+
+mount_nfs || exit 1
+check_counts || FAIL=1
+umount_nfs
+
+if (( FAIL )); then
+    echo "压力测试失败"
+    exit 1
+fi
+echo "压力测试通过"